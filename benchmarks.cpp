@@ -0,0 +1,506 @@
+// benchmarks of the read and write methods over synthetic datasets.
+// results are printed as csv on stdout, progress on stderr.
+//
+// usage: benchmarks [--sizes 1K,1M,64M] [--datasets narrow,wide,numeric,text,quoted] [--repeat 3] [--dir .] [--counters on|off]
+//                   [--threads 0] [--chunk-size 0]
+// sizes go up to 10G, files are generated in --dir and removed after each dataset.
+// --threads takes a list, e.g. 1,2,4,8, the parallel readers and write_async being measured once per thread count
+// so that a single run gives the scaling table. 0 lets readers pick their worker count from the input and
+// write_async use CSV_THREAD_NUM. Sequential methods are measured once with a threads column of 1.
+// on linux, hardware counters are read around each measure with perf_event_open. their columns stay empty when
+// counters are unavailable, e.g. in containers or with a restrictive kernel.perf_event_paranoid.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <cstdio>
+#include <cmath>
+#include "prototypes.hpp"
+
+#ifdef NO_ASYNC
+#error "benchmarks cover the asynchronous methods, build them without NO_ASYNC"
+#endif
+
+#ifdef CSV_POSIX
+#include <sys/resource.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+struct config
+{
+	std::vector<std::uint64_t> sizes = { 1 << 10, 1 << 20, 1 << 26 };
+	std::vector<std::string> datasets = { "narrow", "wide", "numeric", "text", "quoted" };
+	int repeat = 3;
+	std::string directory = ".";
+	bool counters = true;
+	std::vector<int> threads = { 0 };
+	csv::read_options read_options;
+};
+
+
+// -----------------------------------
+// memory
+// -----------------------------------
+
+// peak resident set size is process-wide, linux lets us reset it between measures
+static void reset_peak_rss()
+{
+#ifdef __linux__
+	std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+static std::uint64_t peak_rss_kb()
+{
+#ifdef __linux__
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.rfind("VmHWM:", 0) == 0) {
+			return std::stoull(line.substr(6));
+		}
+	}
+#endif
+#ifdef CSV_POSIX
+	struct rusage usage;
+	::getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return static_cast<std::uint64_t>(usage.ru_maxrss) / 1024;
+#else
+	return static_cast<std::uint64_t>(usage.ru_maxrss);
+#endif
+#else
+	return 0;
+#endif
+}
+
+
+// -----------------------------------
+// hardware counters
+// -----------------------------------
+
+enum counter_event { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, COUNTER_EVENTS };
+
+// counts of a measure, for the calling thread alone and with the threads it started (the async workers)
+struct counter_values
+{
+	bool valid = false;
+	double main[COUNTER_EVENTS] = {};
+	double total[COUNTER_EVENTS] = {};
+};
+
+// one counter per event and scope, opened separately rather than as a group because inherited counters
+// cannot be read as groups. counts are scaled when the kernel multiplexes more events than the pmu holds
+class perf_counters
+{
+public:
+	explicit perf_counters(bool enabled)
+	{
+#ifdef __linux__
+		if (!enabled) {
+			return;
+		}
+		const std::pair<std::uint32_t, std::uint64_t> events[COUNTER_EVENTS] = {
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		};
+		for (int event = 0; event < COUNTER_EVENTS; event++) {
+			for (int inherit = 0; inherit < 2; inherit++) {
+				m_fds[inherit][event] = open(events[event].first, events[event].second, inherit);
+			}
+		}
+		// cycles and instructions are needed by every derived column, the cache events are optional on some cpus
+		m_available = m_fds[0][CYCLES] >= 0 && m_fds[1][CYCLES] >= 0 && m_fds[0][INSTRUCTIONS] >= 0 && m_fds[1][INSTRUCTIONS] >= 0;
+		if (!m_available) {
+			std::cerr << "hardware counters unavailable (" << std::strerror(errno) << "), their columns are left empty" << std::endl;
+		}
+#else
+		(void)enabled;
+#endif
+	}
+
+	~perf_counters()
+	{
+#ifdef __linux__
+		for (auto& scope : m_fds) {
+			for (int fd : scope) {
+				if (fd >= 0) ::close(fd);
+			}
+		}
+#endif
+	}
+
+	perf_counters(const perf_counters&) = delete;
+	perf_counters& operator=(const perf_counters&) = delete;
+
+	void start()
+	{
+#ifdef __linux__
+		// resetting leaves the counts of exited threads, so counts are taken relative to a first reading
+		m_threads = live_threads();
+		for (int scope = 0; scope < 2; scope++) {
+			for (int event = 0; event < COUNTER_EVENTS; event++) {
+				read(m_fds[scope][event], m_start[scope][event]);
+			}
+		}
+		for_each_fd([](int fd) { ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0); });
+#endif
+	}
+
+	// read once the measured threads joined, their counts being added to the inherited counters when they exit
+	counter_values stop()
+	{
+		counter_values values;
+#ifdef __linux__
+		// join returns before the kernel folds the counts of an exiting thread into its parent,
+		// which is done by the time the thread leaves /proc/self/task
+		for (int i = 0; i < 1000 && live_threads() > m_threads; i++) {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		for_each_fd([](int fd) { ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0); });
+		if (!m_available) {
+			return values;
+		}
+		values.valid = true;
+		for (int event = 0; event < COUNTER_EVENTS; event++) {
+			values.main[event] = count(0, event);
+			values.total[event] = count(1, event);
+		}
+#endif
+		return values;
+	}
+
+private:
+#ifdef __linux__
+	static int open(std::uint32_t type, std::uint64_t config, int inherit)
+	{
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.inherit = inherit;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+	}
+
+	// value, time enabled and time running of a counter
+	static bool read(int fd, std::uint64_t (&values)[3])
+	{
+		return fd >= 0 && ::read(fd, values, sizeof(values)) == sizeof(values);
+	}
+
+	// NaN for events that could not be opened or never got scheduled
+	double count(int scope, int event)
+	{
+		std::uint64_t values[3];
+		const std::uint64_t* start = m_start[scope][event];
+		if (!read(m_fds[scope][event], values) || values[2] == start[2]) {
+			return std::numeric_limits<double>::quiet_NaN();
+		}
+		return static_cast<double>(values[0] - start[0]) * static_cast<double>(values[1] - start[1]) / static_cast<double>(values[2] - start[2]);
+	}
+
+	static std::size_t live_threads()
+	{
+		std::error_code error;
+		std::size_t count = 0;
+		for (std::filesystem::directory_iterator task("/proc/self/task", error), end; !error && task != end; task.increment(error)) {
+			count++;
+		}
+		return count;
+	}
+
+	template <typename FUNCTION>
+	void for_each_fd(FUNCTION&& function)
+	{
+		for (auto& scope : m_fds) {
+			for (int fd : scope) {
+				if (fd >= 0) function(fd);
+			}
+		}
+	}
+
+	int m_fds[2][COUNTER_EVENTS] = { { -1, -1, -1, -1, -1 }, { -1, -1, -1, -1, -1 } };
+	std::uint64_t m_start[2][COUNTER_EVENTS][3] = {};
+	std::size_t m_threads = 0;
+#endif
+	bool m_available = false;
+};
+
+// derived columns: per byte and per row counts, with the ipc of the calling thread and of the workers apart
+static void print_counters(const counter_values& values, std::uint64_t bytes, std::size_t rows)
+{
+	const auto print = [](double value) {
+		if (!std::isnan(value) && !std::isinf(value)) std::cout << value;
+	};
+	const auto separate = [&](double value) {
+		std::cout << ',';
+		if (values.valid) print(value);
+	};
+
+	const double* total = values.total;
+	const double* main = values.main;
+	// both scopes are scaled separately under multiplexing, so their difference can be slightly negative
+	const double worker_cycles = std::max(total[CYCLES] - main[CYCLES], 0.0);
+	const double worker_instructions = std::max(total[INSTRUCTIONS] - main[INSTRUCTIONS], 0.0);
+	separate(total[CYCLES] / bytes);
+	separate(total[INSTRUCTIONS] / bytes);
+	separate(total[INSTRUCTIONS] / total[CYCLES]);
+	separate(main[INSTRUCTIONS] / main[CYCLES]);
+	separate(worker_cycles > 0 ? worker_instructions / worker_cycles : std::numeric_limits<double>::quiet_NaN());
+	separate(worker_cycles / total[CYCLES]);
+	separate(total[BRANCH_MISSES] / bytes * 1e6);
+	separate(total[L1D_MISSES] / bytes * 1e6);
+	separate(total[LLC_MISSES] / bytes * 1e6);
+	separate(total[CYCLES] / rows);
+	separate(total[INSTRUCTIONS] / rows);
+	separate(total[BRANCH_MISSES] / rows);
+	separate(total[L1D_MISSES] / rows);
+	separate(total[LLC_MISSES] / rows);
+}
+
+static const char* counter_columns =
+	"cycles_per_byte,instructions_per_byte,ipc,main_ipc,worker_ipc,worker_cycle_share,"
+	"branch_misses_per_mb,l1d_misses_per_mb,llc_misses_per_mb,"
+	"cycles_per_row,instructions_per_row,branch_misses_per_row,l1d_misses_per_row,llc_misses_per_row";
+
+
+// -----------------------------------
+// datasets
+// -----------------------------------
+
+static csv::generator::schema schema_of(const std::string& dataset)
+{
+	using csv::generator::Kind;
+	if (dataset == "narrow") {
+		return csv::generator::person_schema();
+	}
+	if (dataset == "wide") {
+		return csv::generator::single_type_schema(Kind::FLOAT, 64);
+	}
+	if (dataset == "numeric") {
+		return csv::generator::single_type_schema(Kind::INT, 8);
+	}
+
+	auto schema = csv::generator::single_type_schema(Kind::STRING, dataset == "quoted" ? 4 : 8);
+	for (auto& column : schema.columns) {
+		column.min_length = dataset == "quoted" ? 8 : 16;
+		column.max_length = dataset == "quoted" ? 32 : 64;
+		column.quote_rate = dataset == "quoted" ? 0.5 : 0;
+	}
+	return schema;
+}
+
+// write a dataset of about size bytes, always with a header and at least one row
+static void generate(const std::string& dataset, std::uint64_t size, const std::string& path)
+{
+	csv::generator::options options;
+	options.bytes = size;
+	csv::generator::write_file(path, schema_of(dataset), options);
+}
+
+
+// -----------------------------------
+// measures
+// -----------------------------------
+
+// run an operation returning its number of rows and print the median of the repeats,
+// hardware counters being the ones of the median repeat
+static void measure
+(
+	perf_counters& counters,
+	const config& config,
+	const std::string& dataset,
+	std::uint64_t size,
+	std::uint64_t bytes,
+	const std::string& operation,
+	int threads,
+	const std::function<void()>& prepare,
+	const std::function<std::size_t()>& run
+) {
+	std::vector<std::pair<double, counter_values>> repeats;
+	std::size_t rows = 0;
+	std::uint64_t peak = 0;
+
+	for (int i = 0; i < config.repeat; i++) {
+		prepare();
+		reset_peak_rss();
+		const auto start = std::chrono::steady_clock::now();
+		counters.start();
+		rows = run();
+		const counter_values values = counters.stop();
+		repeats.push_back({ std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), values });
+		peak = std::max(peak, peak_rss_kb());
+	}
+
+	std::sort(repeats.begin(), repeats.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+	const auto& median = repeats[repeats.size() / 2];
+	const double seconds = std::max(median.first, 1e-9);
+	std::cout
+		<< dataset << ',' << size << ',' << operation << ',' << threads << ',' << bytes << ',' << rows << ','
+		<< seconds << ',' << bytes / seconds / 1e6 << ',' << rows / seconds << ',' << peak;
+	print_counters(median.second, bytes, std::max<std::size_t>(rows, 1));
+	std::cout << std::endl;
+}
+
+template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+static void run_dataset(perf_counters& counters, const config& config, const std::string& dataset, std::uint64_t size)
+{
+	const std::string path = config.directory + "/bench_" + dataset + "_" + std::to_string(size) + ".csv";
+	const std::string output = path + ".out";
+	std::cerr << "generating " << path << std::endl;
+	generate(dataset, size, path);
+	const std::uint64_t bytes = std::filesystem::file_size(path);
+
+	const auto none = [] {};
+	std::stringstream buffer;
+	const auto load = [&] { buffer = csv::get_buffer_from_file(path); };
+
+	std::cerr << "reading " << path << std::endl;
+	measure(counters, config, dataset, size, bytes, "read_from_buffer", 1, load, [&] {
+		return csv::read_from_buffer<DATA_TYPE, CUSTOM_PROTOTYPE>(buffer)->rows.size();
+	});
+	measure(counters, config, dataset, size, bytes, "read_from_file/DEFAULT", 1, none, [&] {
+		return csv::read_from_file<DATA_TYPE, CUSTOM_PROTOTYPE>(path, csv::Method::DEFAULT)->rows.size();
+	});
+
+	const std::pair<const char*, csv::Method> methods[] = {
+		{ "read_from_file/ASYNC", csv::Method::ASYNC },
+		{ "read_from_file/STREAM", csv::Method::STREAM },
+		{ "read_from_file/MAPPED", csv::Method::MAPPED },
+		{ "read_from_file/AUTO", csv::Method::AUTO },
+	};
+	for (const int threads : config.threads) {
+		csv::read_options read_options = config.read_options;
+		read_options.threads = threads;
+		measure(counters, config, dataset, size, bytes, "read_async_from_buffer", threads, load, [&] {
+			return csv::read_async_from_buffer<DATA_TYPE, CUSTOM_PROTOTYPE>(buffer, nullptr, read_options)->rows.size();
+		});
+		for (const auto& [name, method] : methods) {
+			measure(counters, config, dataset, size, bytes, name, threads, none, [&, method = method] {
+				return csv::read_from_file<DATA_TYPE, CUSTOM_PROTOTYPE>(path, method, nullptr, read_options)->rows.size();
+			});
+		}
+	}
+	buffer = std::stringstream();
+
+	std::cerr << "writing " << output << std::endl;
+	auto document = csv::read_from_file<DATA_TYPE, CUSTOM_PROTOTYPE>(path);
+	measure(counters, config, dataset, size, bytes, "write", 1, none, [&] {
+		csv::write<DATA_TYPE, CUSTOM_PROTOTYPE>(output, document->rows, document->header);
+		return document->rows.size();
+	});
+	for (const int threads : config.threads) {
+		csv::write_options write_options;
+		write_options.threads = threads;
+		measure(counters, config, dataset, size, bytes, "write_async", threads, none, [&] {
+			csv::experimental::write_async<DATA_TYPE, CUSTOM_PROTOTYPE>(output, document->rows, document->header, write_options);
+			return document->rows.size();
+		});
+	}
+
+	std::remove(path.c_str());
+	std::remove(output.c_str());
+}
+
+
+// -----------------------------------
+// command line
+// -----------------------------------
+
+static std::vector<std::string> split(const std::string& list)
+{
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		items.push_back(item);
+	}
+	return items;
+}
+
+// sizes with an optional K, M or G suffix
+static std::uint64_t parse_size(const std::string& size)
+{
+	std::size_t end = 0;
+	std::uint64_t value = std::stoull(size, &end);
+	switch (end < size.size() ? size[end] : ' ')
+	{
+	case 'G': case 'g': value <<= 10; [[fallthrough]];
+	case 'M': case 'm': value <<= 10; [[fallthrough]];
+	case 'K': case 'k': value <<= 10; break;
+	default: break;
+	}
+	return value;
+}
+
+int main(int argc, char** argv)
+{
+	config config;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const std::string option = argv[i];
+		const std::string value = argv[i + 1];
+		if (option == "--sizes") {
+			config.sizes.clear();
+			for (const auto& size : split(value)) config.sizes.push_back(parse_size(size));
+		}
+		else if (option == "--datasets") config.datasets = split(value);
+		else if (option == "--repeat") config.repeat = std::max(1, std::stoi(value));
+		else if (option == "--dir") config.directory = value;
+		else if (option == "--counters") config.counters = value != "off";
+		else if (option == "--threads") {
+			config.threads.clear();
+			for (const auto& threads : split(value)) config.threads.push_back(std::max(0, std::stoi(threads)));
+		}
+		else if (option == "--chunk-size") config.read_options.chunk_size = parse_size(value);
+		else {
+			std::cerr << "unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	perf_counters counters(config.counters);
+	std::cout << "dataset,size,operation,threads,bytes,rows,seconds,mb_per_s,rows_per_s,peak_rss_kb," << counter_columns << std::endl;
+	try {
+		for (const auto& dataset : config.datasets) {
+			for (const std::uint64_t size : config.sizes) {
+				if (dataset == "narrow") {
+					run_dataset<person, person_prototype>(counters, config, dataset, size);
+				}
+				else if (dataset == "wide") {
+					run_dataset<std::vector<float>, csv::experimental::single_type_prototype<float>>(counters, config, dataset, size);
+				}
+				else if (dataset == "numeric") {
+					run_dataset<std::vector<int>, csv::experimental::single_type_prototype<int>>(counters, config, dataset, size);
+				}
+				else if (dataset == "text" || dataset == "quoted") {
+					run_dataset<std::vector<std::string>, csv::experimental::single_type_prototype<std::string>>(counters, config, dataset, size);
+				}
+				else {
+					std::cerr << "unknown dataset " << dataset << std::endl;
+					return 1;
+				}
+			}
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -12,20 +12,94 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <memory>
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
 #include <type_traits>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <charconv>
+#include <filesystem>
+#include <deque>
+#include <unordered_map>
+#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#include <ctime>
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#define CSV_POSIX
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#else
+
+#include <thread>
+
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#define CSV_SSE2
+
+#include <emmintrin.h>
+
+#endif
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sys/inotify.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && !defined(NO_IO_URING)
+
+#define CSV_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#endif
+#endif
+
+#endif
+
+#ifdef CSV_WITH_ZLIB
+
+#include <zlib.h>
+
+#endif
+
+#ifdef CSV_WITH_ZSTD
+
+#include <zstd.h>
+
+#endif
 
 #ifndef NO_ASYNC
 
 #include <queue>
 #include <thread>
-#include <mutex>
 
-constexpr int line_length_hint = 1 << 10;
-constexpr int line_chunk_size = 1 << 5;
-constexpr int thread_num = 1 << 3;
+// number of worker threads of the writers, can be set at build time. Readers pick theirs from the input, see read_options
+#ifndef CSV_THREAD_NUM
+#define CSV_THREAD_NUM (1 << 3)
+#endif
+
+constexpr int thread_num = CSV_THREAD_NUM;
+constexpr int write_block_size = 1 << 12;
 
 #endif
 
@@ -53,6 +127,10 @@ namespace csv
 		struct not_implemented : public err_base {
 			not_implemented(std::string msg) : err_base(std::move(msg)) {}
 		};
+
+		struct header_mismatch : public err_base {
+			header_mismatch(std::string msg) : err_base(std::move(msg)) {}
+		};
 	}
 
 
@@ -73,322 +151,5003 @@ namespace csv
 		return buffer;
 	}
 
-	static void write_buffer_into_file(const std::string& path, std::stringstream& buffer)
+	// time spent in a stage of a read, the cpu time being the one of the threads running it
+	struct stage_time {
+		double wall = 0; // seconds
+		double cpu = 0;
+	};
+
+	// span of a traced read, for a chunk parsed by a worker or a phase of the calling thread
+	struct trace_span {
+		const char* name;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::time_point end;
+		std::chrono::steady_clock::time_point enqueued; // chunks only
+		std::uint64_t bytes = 0;
+		std::uint64_t rows = 0;
+	};
+
+	struct worker_stats {
+		stage_time busy;     // parsing chunks
+		double idle = 0;     // wall seconds spent waiting for chunks
+		std::uint64_t chunks = 0;
+		std::uint64_t rows = 0;
+		std::uint64_t bytes = 0;
+		std::vector<trace_span> spans; // one per chunk when tracing
+	};
+
+	// filled by the readers taking a pointer to it, each call starting from scratch.
+	// defining NO_STATS compiles the recording out.
+	struct read_stats {
+		bool trace = false; // also record spans for write_chrome_trace, kept between calls
+
+		std::chrono::steady_clock::time_point start;
+		std::uint64_t bytes = 0;
+		std::uint64_t rows = 0;
+		std::uint64_t chunks = 0;
+		stage_time load;  // loading the file, or waiting for its blocks when streaming
+		stage_time split; // cutting the input into chunks on the calling thread, range reads include backpressure waits
+		stage_time parse; // deserializing rows, from the first chunk to the last one for parallel reads
+		stage_time merge; // moving the rows of the workers into the document
+		stage_time total;
+		std::vector<worker_stats> workers;
+		std::size_t chunk_size = 0; // bytes of lines per chunk handed to the workers
+		std::size_t queue_high_water = 0; // most chunks waiting in the queue of a worker
+		std::uint64_t in_flight_high_water = 0; // most bytes handed to the workers and not parsed yet
+		double backpressure = 0; // wall seconds the calling thread waited for the workers to catch up
+		// estimate of the buffers allocated by the read, counted where the readers create them rather than measured:
+		// one per streamed chunk, two per row storage of a parallel read and one per string arena slab.
+		// allocations inside deserialize and the growth of the row vectors are not included
+		std::uint64_t estimated_allocations = 0;
+		std::uint64_t arena_bytes = 0;
+		std::vector<trace_span> spans; // phases of the calling thread when tracing
+
+		// decision of Method::AUTO: the method it picked and the estimates it was based on
+		const char* strategy = nullptr;
+		double estimated_parse = 0; // seconds to parse the whole input on one thread, from a sample
+		std::uint64_t available_memory = 0; // 0 when unknown
+		unsigned cores = 0;
+	};
+
+#ifdef NO_STATS
+	constexpr bool stats_enabled = false;
+#else
+	constexpr bool stats_enabled = true;
+#endif
+
+	// cpu time of the calling thread in seconds, of the whole process where threads cannot be told apart
+	static double thread_cpu_time()
+	{
+#ifdef CSV_POSIX
+		timespec now;
+		::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+		return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) * 1e-9;
+#else
+		return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+	}
+
+	// adds the wall and cpu time of its scope to a stage, does nothing for null stages
+	class stage_timer
 	{
-		std::ofstream file(path);
-		if (file.is_open()) {
-			file << buffer.str();
+	public:
+		stage_timer(stage_time* stage) { start(stage); }
+		~stage_timer() { stop(); }
+
+		stage_timer(const stage_timer&) = delete;
+		stage_timer& operator=(const stage_timer&) = delete;
+
+		void start(stage_time* stage)
+		{
+			stop();
+			m_stage = stats_enabled ? stage : nullptr;
+			if (m_stage) {
+				m_wall = std::chrono::steady_clock::now();
+				m_cpu = thread_cpu_time();
+			}
 		}
-		else {
-			throw error::io_exception("Error while trying to open the specified path.");
+
+		void stop()
+		{
+			if (m_stage) {
+				m_stage->wall += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_wall).count();
+				m_stage->cpu += thread_cpu_time() - m_cpu;
+				m_stage = nullptr;
+			}
+		}
+
+	private:
+		stage_time* m_stage = nullptr;
+		std::chrono::steady_clock::time_point m_wall;
+		double m_cpu = 0;
+	};
+
+	// stats to fill, null when none were asked for or when they are compiled out
+	static read_stats* start_stats(read_stats* stats)
+	{
+		if (!stats_enabled || !stats) {
+			return nullptr;
 		}
+		const bool trace = stats->trace;
+		*stats = read_stats();
+		stats->trace = trace;
+		stats->start = std::chrono::steady_clock::now();
+		return stats;
 	}
 
-	static void read_header_from_buffer(std::stringstream& buffer, std::vector<std::string>& header, const char delimiter)
+	// record a phase of the calling thread that started at the given time and ends now
+	static void trace_phase(read_stats* stats, const char* name, std::chrono::steady_clock::time_point start,
+		std::uint64_t bytes = 0, std::uint64_t rows = 0)
 	{
-		// get line
-		std::string header_line;
-		std::getline(buffer, header_line);
+		if (stats && stats->trace) {
+			stats->spans.push_back({ name, start, std::chrono::steady_clock::now(), {}, bytes, rows });
+		}
+	}
 
-		// parse line
-		std::stringstream stream(header_line);
-		std::string cell;
-		while (std::getline(stream, cell, delimiter)) {
-			header.push_back(cell);
+	// loading a file before parsing it is timed outside of the reader, that starts its stats from scratch
+	static void add_load_stats(read_stats* stats, const stage_time& load)
+	{
+		if (!stats_enabled || !stats) {
+			return;
+		}
+		stats->load = load;
+		stats->total.wall += load.wall;
+		stats->total.cpu += load.cpu;
+		if (stats->trace) {
+			const auto load_start = stats->start - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(load.wall));
+			stats->spans.insert(stats->spans.begin(), { "load", load_start, stats->start, {}, stats->bytes, 0 });
 		}
 	}
 
+	// bytes left to read in a buffer, in_avail only covering its current get area
+	static std::uint64_t remaining_bytes(std::stringstream& buffer)
+	{
+		std::stringbuf& content = *buffer.rdbuf();
+		const auto position = content.pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+		const auto end = content.pubseekoff(0, std::ios_base::end, std::ios_base::in);
+		content.pubseekpos(position, std::ios_base::in);
+		return static_cast<std::uint64_t>(end - position);
+	}
+
+	// unread bytes of the get area of a buffer, viewed in place. They are all the bytes left to read when the string
+	// buffer keeps its content in a single string, as the usual standard libraries do
+	static std::string_view get_area(std::stringstream& buffer)
+	{
+		// the get area pointers are protected, member pointers named through a derived class reach them on any stringbuf
+		struct access : std::stringbuf {
+			static std::string_view of(std::stringbuf& content) {
+				char* const begin = (content.*&access::gptr)();
+				return begin ? std::string_view(begin, (content.*&access::egptr)() - begin) : std::string_view();
+			}
+		};
+		return access::of(*buffer.rdbuf());
+	}
 
-	// -----------------
-	// [ SECTION ] TYPES
-	// -----------------
+	static std::stringstream load_buffer_from_file(const std::string& path, stage_time* load)
+	{
+		stage_timer timer(load);
+		return get_buffer_from_file(path);
+	}
 
+#ifndef NO_ASYNC
+	// chunk size and worker count of the parallel readers, those left to 0 being picked from the input
+	struct read_options {
+		std::size_t chunk_size = 0; // bytes of complete lines handed to a worker at once
+		int threads = 0;
+		// chunks and bytes handed to the workers and not parsed yet. The producer waits when either is reached,
+		// which bounds the memory of streamed reads. 0 picks 4 chunks per worker, and no bound on bytes
+		std::size_t max_in_flight_chunks = 0;
+		std::uint64_t max_in_flight_bytes = 0;
+	};
 
-	// Template base class used to create user-defined prototypes
-	// Prototypes are passed to read & write function to deserialize and serialize any user-defined types
-	template<typename DATA_TYPE>
-	class prototype {
-	public:
-		virtual void serialize(std::stringstream& buffer, const DATA_TYPE& data) const {
-			throw std::logic_error("The method or operation is not implemented.");
+	// size of the cache a chunk should fit in while a worker parses it: the L2 cache where it can be queried
+	static std::size_t cache_size()
+	{
+#if defined(__linux__) && defined(_SC_LEVEL2_CACHE_SIZE)
+		const long size = ::sysconf(_SC_LEVEL2_CACHE_SIZE);
+		if (size > 0) {
+			return static_cast<std::size_t>(size);
+		}
+#endif
+		return 1 << 20;
+	}
+
+	// average length of the complete lines of a sample, 0 when it holds none
+	static double average_line_length(std::string_view sample)
+	{
+		const std::size_t lines = static_cast<std::size_t>(std::count(sample.begin(), sample.end(), '\n'));
+		return lines ? static_cast<double>(sample.rfind('\n') + 1) / lines : 0;
+	}
+
+	// pick the options left to 0 from the size of the input (0 when unknown) and a sample of its lines.
+	// each worker gets at least 256KB of input, and enough chunks to even out their load. Chunks hold at least
+	// a few hundred lines to amortize the hand-off, and stay within the cache for large inputs
+	static read_options tune_read_options(read_options options, std::uint64_t input_size, std::string_view sample = {})
+	{
+		constexpr std::uint64_t min_bytes_per_worker = 1 << 18;
+		constexpr std::uint64_t chunks_per_worker = 8;
+		constexpr std::size_t min_chunk_lines = 256;
+		constexpr std::size_t min_chunk_size = 1 << 15;
+
+		const std::uint64_t hardware = std::max(1u, std::thread::hardware_concurrency());
+		if (options.threads <= 0) {
+			const std::uint64_t threads = input_size ? std::clamp<std::uint64_t>(input_size / min_bytes_per_worker, 1, hardware) : hardware;
+			options.threads = static_cast<int>(threads);
+		}
+		if (!options.chunk_size) {
+			const std::size_t lower = std::max(min_chunk_size, static_cast<std::size_t>(average_line_length(sample) * min_chunk_lines));
+			const std::size_t upper = std::max(lower, cache_size());
+			const std::uint64_t chunk = input_size ? input_size / (options.threads * chunks_per_worker) : upper;
+			options.chunk_size = static_cast<std::size_t>(std::clamp<std::uint64_t>(chunk, lower, upper));
+		}
+		if (!options.max_in_flight_chunks) {
+			options.max_in_flight_chunks = static_cast<std::size_t>(options.threads) * 4;
+		}
+		return options;
+	}
+#endif
+
+	// write the spans of a traced read as chrome trace json, to open in chrome://tracing or ui.perfetto.dev.
+	// the calling thread is shown as thread 0 and the workers from 1, chunks recording their wait in the queue
+	inline void write_chrome_trace(const std::string& path, const read_stats& stats)
+	{
+		auto origin = stats.start;
+		for (const trace_span& span : stats.spans) {
+			origin = std::min(origin, span.start);
+		}
+		const auto micros = [&](std::chrono::steady_clock::time_point time) {
+			return std::chrono::duration<double, std::micro>(time - origin).count();
 		};
-		virtual DATA_TYPE deserialize(std::stringstream& buffer) const {
-			throw std::logic_error("The method or operation is not implemented.");
+
+		std::ofstream file(path);
+		if (!file.is_open()) {
+			throw error::io_exception("Error while trying to open the specified path.");
 		}
-		virtual inline const char get_delimiter() const { return ','; }
-	protected:
-		prototype() = default;
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}}";
+		for (std::size_t i = 0; i < stats.workers.size(); i++) {
+			file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i + 1
+				<< ",\"args\":{\"name\":\"worker " << i << "\"}}";
+		}
+
+		const auto write_span = [&](const trace_span& span, std::size_t tid) {
+			file << ",\n{\"name\":\"" << span.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+				<< ",\"ts\":" << micros(span.start) << ",\"dur\":" << micros(span.end) - micros(span.start)
+				<< ",\"args\":{\"bytes\":" << span.bytes << ",\"rows\":" << span.rows;
+			if (span.enqueued != std::chrono::steady_clock::time_point()) {
+				file << ",\"enqueued_us\":" << micros(span.enqueued) << ",\"queued_us\":" << micros(span.start) - micros(span.enqueued);
+			}
+			file << "}}";
+		};
+		for (const trace_span& span : stats.spans) {
+			write_span(span, 0);
+		}
+		for (std::size_t i = 0; i < stats.workers.size(); i++) {
+			for (const trace_span& span : stats.workers[i].spans) {
+				write_span(span, i + 1);
+			}
+		}
+		file << "\n]}\n";
+
+		if (!file) {
+			throw error::io_exception("Error while writing the trace file.");
+		}
+	}
+
+	// compression of files, detected from their first bytes when reading
+	enum class Compression {
+		NONE,
+		GZIP, // needs CSV_WITH_ZLIB and linking zlib
+		ZSTD, // needs CSV_WITH_ZSTD and linking libzstd
 	};
 
-	// static check for user user-defined prototypes
-#define CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE) static_assert(std::is_base_of<prototype<DATA_TYPE>, CUSTOM_PROTOTYPE>::value, "CUSTOM_PROTOTYPE should derive from csv::prototype.");
+	static Compression detect_compression(std::string_view bytes)
+	{
+		if (bytes.size() >= 2 && bytes[0] == '\x1f' && bytes[1] == '\x8b') {
+			return Compression::GZIP;
+		}
+		if (bytes.size() >= 4 && bytes.substr(0, 4) == std::string_view("\x28\xb5\x2f\xfd", 4)) {
+			return Compression::ZSTD;
+		}
+		return Compression::NONE;
+	}
 
-	// the object returned when reading csv files
-	template <typename DATA_TYPE>
-	struct Document {
-		std::vector<std::string> header;
-		std::vector<DATA_TYPE> rows;
+	static Compression detect_compression(const std::string& path)
+	{
+		char bytes[4];
+		std::ifstream file(path, std::ios::binary);
+		file.read(bytes, sizeof(bytes));
+		return detect_compression(std::string_view(bytes, static_cast<std::size_t>(file.gcount())));
+	}
+
+	// compresses data into independent gzip members or zstd frames, so that they can be decompressed in parallel
+	class encoder
+	{
+	public:
+		virtual ~encoder() = default;
+
+		// append the compressed data to output
+		virtual void encode(const char* data, std::size_t size, std::string& output) = 0;
 	};
 
+	// decompresses a stream of gzip members or zstd frames
+	class decoder
+	{
+	public:
+		virtual ~decoder() = default;
 
-	// -----------------------------------
-	// [ SECTION ] Read & Write functions
-	// -----------------------------------
+		// decompress input into output until the input is consumed or output is full, returns the number of bytes written
+		virtual std::size_t decode(std::string_view& input, char* output, std::size_t capacity) = 0;
 
+		// true when the input decoded so far ends on a complete member or frame
+		virtual bool complete() const = 0;
+	};
 
-	// linearly read and deserialize data from csv file, slower than the read_async_from_folder method
-	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
-	static std::unique_ptr<Document<DATA_TYPE>> read_from_buffer
-	(
-		std::stringstream& buffer
-	) {
-		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
-			CUSTOM_PROTOTYPE proto;
-		auto doc = std::make_unique<Document<DATA_TYPE>>();
+#ifdef CSV_WITH_ZLIB
+	// members written like BGZF blocks: the extra field "BC" of their header records their compressed size,
+	// which lets readers find members without decompressing. Other gzip readers see a plain multi-member file.
+	class gzip_encoder : public encoder
+	{
+	public:
+		static constexpr std::size_t member_size = 0xff00;
+		static constexpr std::size_t header_size = 18;
 
-		read_header_from_buffer(buffer, doc->header, proto.get_delimiter());
+		gzip_encoder(int level) {
+			std::memset(&m_stream, 0, sizeof(m_stream));
+			if (deflateInit2(&m_stream, level ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+				throw std::bad_alloc();
+			}
+		}
 
-		// fill rows
-		std::string line;
-		while (std::getline(buffer, line))
+		~gzip_encoder() { deflateEnd(&m_stream); }
+
+		void encode(const char* data, std::size_t size, std::string& output) override
 		{
-			std::stringstream s(line);
-			doc->rows.push_back(proto.deserialize(s));
+			for (std::size_t offset = 0; offset < size; offset += member_size) {
+				encode_member(data + offset, std::min(member_size, size - offset), output);
+			}
 		}
-		return doc;
+
+	private:
+		void encode_member(const char* data, std::size_t size, std::string& output)
+		{
+			static const unsigned char header[header_size] = {
+				0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0
+			};
+			const std::size_t start = output.size();
+			output.resize(start + header_size + deflateBound(&m_stream, static_cast<uLong>(size)) + 8);
+			std::memcpy(&output[start], header, header_size);
+
+			deflateReset(&m_stream);
+			m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+			m_stream.avail_in = static_cast<uInt>(size);
+			m_stream.next_out = reinterpret_cast<Bytef*>(&output[start + header_size]);
+			m_stream.avail_out = static_cast<uInt>(output.size() - start - header_size);
+			if (deflate(&m_stream, Z_FINISH) != Z_STREAM_END) {
+				throw error::io_exception("Error while trying to compress data.");
+			}
+
+			std::size_t end = output.size() - m_stream.avail_out;
+			const uLong crc = crc32(crc32(0, nullptr, 0), reinterpret_cast<const Bytef*>(data), static_cast<uInt>(size));
+			end = put_u32(output, end, static_cast<std::uint32_t>(crc));
+			end = put_u32(output, end, static_cast<std::uint32_t>(size));
+			output.resize(end);
+
+			const std::size_t block_size = end - start - 1;
+			output[start + 16] = static_cast<char>(block_size & 0xff);
+			output[start + 17] = static_cast<char>(block_size >> 8);
+		}
+
+		static std::size_t put_u32(std::string& output, std::size_t position, std::uint32_t value)
+		{
+			for (int i = 0; i < 4; i++) {
+				output[position++] = static_cast<char>((value >> (8 * i)) & 0xff);
+			}
+			return position;
+		}
+
+	private:
+		z_stream m_stream;
+	};
+
+	class gzip_decoder : public decoder
+	{
+	public:
+		gzip_decoder() {
+			std::memset(&m_stream, 0, sizeof(m_stream));
+			if (inflateInit2(&m_stream, 15 + 16) != Z_OK) {
+				throw std::bad_alloc();
+			}
+		}
+
+		~gzip_decoder() { inflateEnd(&m_stream); }
+
+		std::size_t decode(std::string_view& input, char* output, std::size_t capacity) override
+		{
+			m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+			m_stream.avail_in = static_cast<uInt>(std::min<std::size_t>(input.size(), std::numeric_limits<uInt>::max()));
+			m_stream.next_out = reinterpret_cast<Bytef*>(output);
+			m_stream.avail_out = static_cast<uInt>(std::min<std::size_t>(capacity, std::numeric_limits<uInt>::max()));
+			const uInt available = m_stream.avail_in;
+			const uInt space = m_stream.avail_out;
+
+			while (m_stream.avail_out)
+			{
+				// members are concatenated, the next one starts right after the end of the previous one
+				if (m_complete) {
+					if (!m_stream.avail_in) break;
+					inflateReset(&m_stream);
+					m_complete = false;
+				}
+				const int result = inflate(&m_stream, Z_NO_FLUSH);
+				if (result == Z_STREAM_END) {
+					m_complete = true;
+				}
+				else if (result == Z_BUF_ERROR) {
+					break; // needs more input
+				}
+				else if (result != Z_OK) {
+					throw error::io_exception("Error while trying to decompress data.");
+				}
+			}
+
+			input.remove_prefix(available - m_stream.avail_in);
+			return space - m_stream.avail_out;
+		}
+
+		bool complete() const override { return m_complete; }
+
+	private:
+		z_stream m_stream;
+		bool m_complete = true;
+	};
+
+	// offsets of the members of a gzip file written by gzip_encoder, empty when their sizes are not recorded
+	static std::vector<std::string_view> find_gzip_members(std::string_view data)
+	{
+		std::vector<std::string_view> members;
+		while (!data.empty()) {
+			const auto byte = [&](std::size_t i) { return static_cast<std::size_t>(static_cast<unsigned char>(data[i])); };
+			if (data.size() < gzip_encoder::header_size || byte(0) != 0x1f || byte(1) != 0x8b || !(byte(3) & 4)
+				|| byte(10) != 6 || byte(11) != 0 || data[12] != 'B' || data[13] != 'C') {
+				return {};
+			}
+			const std::size_t size = (byte(16) | (byte(17) << 8)) + 1;
+			if (size > data.size()) {
+				return {};
+			}
+			members.push_back(data.substr(0, size));
+			data.remove_prefix(size);
+		}
+		return members;
 	}
+#endif
+
+#ifdef CSV_WITH_ZSTD
+	class zstd_encoder : public encoder
+	{
+	public:
+		zstd_encoder(int level) : m_context(ZSTD_createCCtx()), m_level(level) {
+			if (!m_context) {
+				throw std::bad_alloc();
+			}
+		}
+
+		~zstd_encoder() { ZSTD_freeCCtx(m_context); }
+
+		void encode(const char* data, std::size_t size, std::string& output) override
+		{
+			if (!size) {
+				return;
+			}
+			const std::size_t start = output.size();
+			output.resize(start + ZSTD_compressBound(size));
+			const std::size_t written = ZSTD_compressCCtx(m_context, &output[start], output.size() - start, data, size, m_level);
+			if (ZSTD_isError(written)) {
+				throw error::io_exception("Error while trying to compress data.");
+			}
+			output.resize(start + written);
+		}
+
+	private:
+		ZSTD_CCtx* m_context;
+		const int m_level;
+	};
+
+	class zstd_decoder : public decoder
+	{
+	public:
+		zstd_decoder() : m_stream(ZSTD_createDStream()) {
+			if (!m_stream) {
+				throw std::bad_alloc();
+			}
+		}
+
+		~zstd_decoder() { ZSTD_freeDStream(m_stream); }
+
+		std::size_t decode(std::string_view& input, char* output, std::size_t capacity) override
+		{
+			ZSTD_inBuffer in = { input.data(), input.size(), 0 };
+			ZSTD_outBuffer out = { output, capacity, 0 };
+			while (out.pos < out.size)
+			{
+				const std::size_t consumed = in.pos;
+				const std::size_t produced = out.pos;
+				const std::size_t result = ZSTD_decompressStream(m_stream, &out, &in);
+				if (ZSTD_isError(result)) {
+					throw error::io_exception("Error while trying to decompress data.");
+				}
+				if (in.pos == consumed && out.pos == produced) {
+					break;
+				}
+				m_complete = result == 0;
+			}
+			input.remove_prefix(in.pos);
+			return out.pos;
+		}
 
+		bool complete() const override { return m_complete; }
+
+	private:
+		ZSTD_DStream* m_stream;
+		bool m_complete = true;
+	};
+
+	// offsets of the frames of a zstd file
+	static std::vector<std::string_view> find_zstd_frames(std::string_view data)
+	{
+		std::vector<std::string_view> frames;
+		while (!data.empty()) {
+			const std::size_t size = ZSTD_findFrameCompressedSize(data.data(), data.size());
+			if (ZSTD_isError(size)) {
+				return {};
+			}
+			frames.push_back(data.substr(0, size));
+			data.remove_prefix(size);
+		}
+		return frames;
+	}
+#endif
+
+	// level 0 picks the default level of the codec
+	static std::unique_ptr<encoder> make_encoder(Compression compression, [[maybe_unused]] int level)
+	{
+		switch (compression)
+		{
+		case Compression::NONE:
+			return nullptr;
+#ifdef CSV_WITH_ZLIB
+		case Compression::GZIP:
+			return std::make_unique<gzip_encoder>(level);
+#endif
+#ifdef CSV_WITH_ZSTD
+		case Compression::ZSTD:
+			return std::make_unique<zstd_encoder>(level);
+#endif
+		default:
+			throw error::not_implemented("Compression not available, define CSV_WITH_ZLIB or CSV_WITH_ZSTD.");
+		}
+	}
+
+	static std::unique_ptr<decoder> make_decoder(Compression compression)
+	{
+		switch (compression)
+		{
+#ifdef CSV_WITH_ZLIB
+		case Compression::GZIP:
+			return std::make_unique<gzip_decoder>();
+#endif
+#ifdef CSV_WITH_ZSTD
+		case Compression::ZSTD:
+			return std::make_unique<zstd_decoder>();
+#endif
+		default:
+			throw error::not_implemented("Compression not available, define CSV_WITH_ZLIB or CSV_WITH_ZSTD.");
+		}
+	}
+
+	// independently compressed members or frames of a file, empty when they cannot be found without decompressing
+	static std::vector<std::string_view> find_frames(Compression compression, [[maybe_unused]] std::string_view data)
+	{
+		switch (compression)
+		{
+#ifdef CSV_WITH_ZLIB
+		case Compression::GZIP:
+			return find_gzip_members(data);
+#endif
+#ifdef CSV_WITH_ZSTD
+		case Compression::ZSTD:
+			return find_zstd_frames(data);
+#endif
+		default:
+			return {};
+		}
+	}
+
+	// when written data is forced to the storage device
+	enum class Durability {
+		NONE,     // left to the OS writeback
+		END,      // fdatasync once the file is complete
+		PERIODIC, // writeback started every sync_interval bytes (sync_file_range on linux), then fdatasync at the end
+	};
+
+	struct write_options {
+		// write into a temporary file renamed over the target once complete, readers never see a partial file
+		bool atomic = false;
+		// append to the file instead of truncating it. Rows are only written by whole lines in single
+		// O_APPEND writes, so the lines of concurrent appenders of a process are never interleaved
+		bool append = false;
+		Durability durability = Durability::NONE;
+		std::uint64_t sync_interval = 1 << 26;
+		// size of the buffer of the stream writers
+		std::size_t buffer_size = 1 << 20;
+		// bypass the page cache with O_DIRECT where supported, through aligned double-buffered blocks
+		bool direct_io = false;
+		// compress the output, each write becoming independent gzip members or zstd frames
+		Compression compression = Compression::NONE;
+		// 0 picks the default level of the codec
+		int compression_level = 0;
+		// worker threads of write_async, 0 uses CSV_THREAD_NUM
+		int threads = 0;
+	};
+
+#ifdef O_DIRECT
+	// writes a file opened with O_DIRECT through two aligned blocks: the caller fills one while the other is
+	// written by a background thread. The unaligned tail is padded to the alignment, then truncated on finish.
+	// file systems accepting O_DIRECT when opening but not when writing are switched back to the page cache
+	class direct_writer
+	{
+	public:
+		static constexpr std::size_t alignment = 1 << 12;
+		static constexpr std::size_t block_size = 1 << 22;
+
+		direct_writer(int fd)
+			: m_fd(fd)
+		{
+			for (auto& block : m_blocks) {
+				block.reset(static_cast<char*>(::operator new(block_size, std::align_val_t(alignment))));
+			}
+#ifndef NO_ASYNC
+			m_worker = std::thread([&]() { run(); });
+#endif
+		}
+
+		~direct_writer() {
+#ifndef NO_ASYNC
+			{
+				std::lock_guard<std::mutex> lg(m_lock);
+				m_running = false;
+			}
+			m_cv.notify_all();
+			m_worker.join();
+#endif
+		}
+
+		direct_writer(const direct_writer&) = delete;
+		direct_writer& operator=(const direct_writer&) = delete;
+
+		void write(const char* data, std::size_t size)
+		{
+			while (size) {
+				const std::size_t length = std::min(size, block_size - m_filled);
+				std::memcpy(m_blocks[m_current].get() + m_filled, data, length);
+				m_filled += length;
+				data += length;
+				size -= length;
+				if (m_filled == block_size) {
+					submit();
+				}
+			}
+		}
+
+		// write the last block and truncate the padding away
+		void finish()
+		{
+			wait_idle();
+			if (m_filled) {
+				const std::size_t padded = (m_filled + alignment - 1) / alignment * alignment;
+				std::memset(m_blocks[m_current].get() + m_filled, 0, padded - m_filled);
+				if (!write_block(m_blocks[m_current].get(), padded, m_offset) || ::ftruncate(m_fd, static_cast<off_t>(m_offset + m_filled)) != 0) {
+					throw error::io_exception("Error while trying to write into the specified path.");
+				}
+				m_offset += m_filled;
+				m_filled = 0;
+			}
+		}
+
+	private:
+		struct aligned_delete {
+			void operator()(char* block) const { ::operator delete(block, std::align_val_t(alignment)); }
+		};
+
+		bool write_block(const char* data, std::size_t size, std::uint64_t offset)
+		{
+			while (size) {
+				const ssize_t written = ::pwrite(m_fd, data, size, static_cast<off_t>(offset));
+				if (written < 0 && errno == EINTR) {
+					continue;
+				}
+				if (written < 0 && errno == EINVAL && !m_checked) {
+					const int flags = ::fcntl(m_fd, F_GETFL);
+					if (flags < 0 || ::fcntl(m_fd, F_SETFL, flags & ~O_DIRECT) != 0) {
+						return false;
+					}
+					m_checked = true;
+					continue;
+				}
+				m_checked = true;
+				if (written <= 0) {
+					return false;
+				}
+				data += written;
+				offset += static_cast<std::uint64_t>(written);
+				size -= static_cast<std::size_t>(written);
+			}
+			return true;
+		}
+
+		// hand the full block over to the writing thread and continue with the other one
+		void submit()
+		{
+#ifndef NO_ASYNC
+			wait_idle();
+			{
+				std::lock_guard<std::mutex> lg(m_lock);
+				m_pending = m_blocks[m_current].get();
+				m_pending_offset = m_offset;
+			}
+			m_cv.notify_all();
+			m_current ^= 1;
+#else
+			if (!write_block(m_blocks[m_current].get(), block_size, m_offset)) {
+				throw error::io_exception("Error while trying to write into the specified path.");
+			}
+#endif
+			m_offset += block_size;
+			m_filled = 0;
+		}
+
+		void wait_idle()
+		{
+#ifndef NO_ASYNC
+			std::unique_lock<std::mutex> ul(m_lock);
+			m_cv.wait(ul, [&] { return !m_pending; });
+			if (m_failed) {
+				throw error::io_exception("Error while trying to write into the specified path.");
+			}
+#endif
+		}
+
+#ifndef NO_ASYNC
+		void run()
+		{
+			std::unique_lock<std::mutex> ul(m_lock);
+			while (true)
+			{
+				m_cv.wait(ul, [&] { return m_pending || !m_running; });
+				if (!m_pending) {
+					return;
+				}
+				ul.unlock();
+				const bool written = write_block(m_pending, block_size, m_pending_offset);
+				ul.lock();
+				m_failed = m_failed || !written;
+				m_pending = nullptr;
+				m_cv.notify_all();
+			}
+		}
+#endif
+
+	private:
+		const int m_fd;
+		std::unique_ptr<char, aligned_delete> m_blocks[2];
+		int m_current = 0;
+		std::size_t m_filled = 0;
+		std::uint64_t m_offset = 0;
+		bool m_checked = false; // the first write went through, only written by the thread writing blocks
+
+#ifndef NO_ASYNC
+		std::thread m_worker;
+		std::mutex m_lock;
+		std::condition_variable m_cv;
+		const char* m_pending = nullptr;
+		std::uint64_t m_pending_offset = 0;
+		bool m_running = true;
+		bool m_failed = false;
+#endif
+	};
+#endif
+
+	// name next to a file for a write renamed over it once complete. the process id, a timestamp
+	// and a counter keep concurrent writers of the same file apart, in this process or in others
+	inline std::string temporary_path_for(const std::string& path)
+	{
+		static std::atomic<unsigned int> counter = 0;
+		std::stringstream temporary_path;
+		temporary_path << path << ".tmp.";
+#ifdef CSV_POSIX
+		temporary_path << getpid() << '.';
+#endif
+		temporary_path << std::chrono::steady_clock::now().time_since_epoch().count() << '.' << counter++;
+		return temporary_path.str();
+	}
+
+	// file opened for writing, written through its file descriptor on POSIX systems
+	class output_file
+	{
+	public:
+		output_file(const std::string& path, const write_options& options = {})
+			: m_path(path), m_options(options), m_encoder(make_encoder(options.compression, options.compression_level))
+		{
+			if (m_options.atomic && m_options.append) {
+				throw std::invalid_argument("Atomic writes cannot append to a file.");
+			}
+			if (m_options.direct_io && m_options.append) {
+				throw std::invalid_argument("Direct writes cannot append to a file.");
+			}
+			if (m_options.atomic) {
+				m_temporary_path = temporary_path_for(path);
+			}
+			const std::string& open_path = m_options.atomic ? m_temporary_path : m_path;
+#ifdef CSV_POSIX
+			const int mode = m_options.atomic ? O_EXCL : m_options.append ? O_APPEND : O_TRUNC;
+#ifdef O_DIRECT
+			if (m_options.direct_io) {
+				m_fd = ::open(open_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | O_DIRECT | mode, 0666);
+				if (m_fd >= 0) {
+					m_direct = std::make_unique<direct_writer>(m_fd);
+				}
+			}
+			// file systems without O_DIRECT support, e.g. tmpfs, are written through the page cache
+			if (m_fd < 0)
+#endif
+			m_fd = ::open(open_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | mode, 0666);
+			struct stat file_stat;
+			if (m_fd < 0 || ::fstat(m_fd, &file_stat) != 0) {
+				throw error::io_exception("Error while trying to open the specified path.");
+			}
+			m_initial_size = static_cast<std::uint64_t>(file_stat.st_size);
+
+			// the temporary file replaces the target with its mode and, when allowed, its owner,
+			// so that a private file does not become readable by others once rewritten
+			struct stat target_stat;
+			if (m_options.atomic && ::stat(m_path.c_str(), &target_stat) == 0) {
+				if (::fchmod(m_fd, target_stat.st_mode & 07777) != 0) {
+					throw error::io_exception("Error while trying to open the specified path.");
+				}
+				// only privileged processes can give a file away, the group alone may still be kept
+				if (::fchown(m_fd, target_stat.st_uid, target_stat.st_gid) != 0 && ::fchown(m_fd, static_cast<uid_t>(-1), target_stat.st_gid) != 0) {
+					// left to the owner and group of the writing process
+				}
+			}
+#else
+			std::error_code ec;
+			m_initial_size = m_options.append ? std::filesystem::file_size(open_path, ec) : 0;
+			if (ec) {
+				m_initial_size = 0;
+			}
+			m_file.open(open_path, m_options.append ? std::ios::app : std::ios::out);
+			if (!m_file.is_open()) {
+				throw error::io_exception("Error while trying to open the specified path.");
+			}
+#endif
+		}
+
+		// a file that was not closed is incomplete: the temporary file of an atomic write is removed
+		~output_file() {
+#ifdef O_DIRECT
+			m_direct.reset();
+#endif
+#ifdef CSV_POSIX
+			if (m_fd >= 0) ::close(m_fd);
+#else
+			m_file.close();
+#endif
+			if (!m_closed && m_options.atomic) {
+				std::error_code ec;
+				std::filesystem::remove(m_temporary_path, ec);
+			}
+		}
+
+		output_file(const output_file&) = delete;
+		output_file& operator=(const output_file&) = delete;
+
+		// true when the file is written through aligned direct blocks, only sequential writes are supported then.
+		// the blocks may still go through the page cache if the file system rejected their first write
+		bool direct() const {
+#ifdef O_DIRECT
+			return m_direct != nullptr;
+#else
+			return false;
+#endif
+		}
+
+		// size of the file when it was opened, only non-zero when appending to an existing file
+		std::uint64_t initial_size() const { return m_initial_size; }
+
+		Compression compression() const { return m_options.compression; }
+
+		void write(const char* data, std::size_t size)
+		{
+			if (m_encoder) {
+				m_encoded.clear();
+				m_encoder->encode(data, size, m_encoded);
+				write_encoded(m_encoded.data(), m_encoded.size());
+				return;
+			}
+			write_encoded(data, size);
+		}
+
+		// write data already compressed according to the compression of the file
+		void write_encoded(const char* data, std::size_t size)
+		{
+#ifdef O_DIRECT
+			if (m_direct) {
+				m_direct->write(data, size);
+				return;
+			}
+#endif
+#ifdef CSV_POSIX
+			const std::size_t total = size;
+			while (size) {
+				const ssize_t written = ::write(m_fd, data, size);
+				if (written < 0 && errno == EINTR) {
+					continue;
+				}
+				if (written <= 0) {
+					throw error::io_exception("Error while trying to write into the specified path.");
+				}
+				data += written;
+				size -= static_cast<std::size_t>(written);
+			}
+			written(total);
+#else
+			if (!m_file.write(data, static_cast<std::streamsize>(size))) {
+				throw error::io_exception("Error while trying to write into the specified path.");
+			}
+#endif
+		}
+
+#ifdef CSV_POSIX
+		// positional write of data already compressed, threads can write distinct ranges of the file at the same time
+		void write_at(const char* data, std::size_t size, std::uint64_t offset)
+		{
+			if (direct()) {
+				throw std::logic_error("Direct writes are sequential.");
+			}
+			const std::size_t total = size;
+			while (size) {
+				const ssize_t written = ::pwrite(m_fd, data, size, static_cast<off_t>(offset));
+				if (written < 0 && errno == EINTR) {
+					continue;
+				}
+				if (written <= 0) {
+					throw error::io_exception("Error while trying to write into the specified path.");
+				}
+				data += written;
+				offset += static_cast<std::uint64_t>(written);
+				size -= static_cast<std::size_t>(written);
+			}
+			written(total);
+		}
+#endif
+
+		// flush the file according to the durability policy, then move it to its final path for atomic writes
+		void close()
+		{
+#ifdef O_DIRECT
+			if (m_direct) {
+				m_direct->finish();
+				m_direct.reset();
+			}
+#endif
+#ifdef CSV_POSIX
+			const int fd = m_fd;
+			m_fd = -1;
+			const bool synced = fd < 0 || m_options.durability == Durability::NONE || sync_data(fd);
+			if (fd >= 0 && (::close(fd) != 0 || !synced)) {
+				throw error::io_exception("Error while trying to write into the specified path.");
+			}
+#else
+			m_file.close();
+			if (m_file.fail()) {
+				throw error::io_exception("Error while trying to write into the specified path.");
+			}
+#endif
+			if (m_options.atomic && !m_closed) {
+				std::error_code ec;
+#ifndef CSV_POSIX
+				// the temporary file replaces the target with its permissions
+				const auto target = std::filesystem::status(m_path, ec);
+				if (!ec && std::filesystem::exists(target)) {
+					std::filesystem::permissions(m_temporary_path, target.permissions(), ec);
+				}
+#endif
+				std::filesystem::rename(m_temporary_path, m_path, ec);
+				if (ec) {
+					throw error::io_exception("Error while trying to write into the specified path.");
+				}
+#ifdef CSV_POSIX
+				// the rename itself is only durable once the directory is synced
+				if (m_options.durability != Durability::NONE) {
+					const std::string directory = std::filesystem::absolute(m_path).parent_path().string();
+					const int directory_fd = ::open(directory.c_str(), O_RDONLY | O_CLOEXEC);
+					if (directory_fd >= 0) {
+						::fsync(directory_fd);
+						::close(directory_fd);
+					}
+				}
+#endif
+			}
+			m_closed = true;
+		}
+
+	private:
+#ifdef CSV_POSIX
+		static bool sync_data(int fd) {
+#ifdef __APPLE__
+			return ::fsync(fd) == 0;
+#else
+			return ::fdatasync(fd) == 0;
+#endif
+		}
+
+		// periodic durability: start the writeback of the last interval without waiting for it, and wait
+		// for the writeback of the interval before, so dirty pages never pile up beyond two intervals
+		void written(std::size_t size)
+		{
+			if (m_options.durability != Durability::PERIODIC) {
+				return;
+			}
+			const std::uint64_t total = m_written += size;
+			if (total - m_synced < m_options.sync_interval) {
+				return;
+			}
+
+			std::lock_guard<std::mutex> lg(m_sync_lock);
+			const std::uint64_t synced = m_synced;
+			if (total - synced < m_options.sync_interval) {
+				return;
+			}
+#ifdef __linux__
+			// ranges are approximate for positional writes, which only matters for the amount of pages in flight
+			::sync_file_range(m_fd, static_cast<off_t>(synced), static_cast<off_t>(total - synced), SYNC_FILE_RANGE_WRITE);
+			if (synced) {
+				::sync_file_range(m_fd, static_cast<off_t>(m_previous_synced), static_cast<off_t>(synced - m_previous_synced),
+					SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+			}
+#else
+			sync_data(m_fd);
+#endif
+			m_previous_synced = synced;
+			m_synced = total;
+		}
+#endif
+
+	private:
+		const std::string m_path;
+		const write_options m_options;
+		std::string m_temporary_path;
+		std::uint64_t m_initial_size = 0;
+		bool m_closed = false;
+		std::unique_ptr<encoder> m_encoder;
+		std::string m_encoded;
+
+#ifdef CSV_POSIX
+		int m_fd = -1;
+		std::atomic<std::uint64_t> m_written = 0;
+		std::atomic<std::uint64_t> m_synced = 0;
+		std::uint64_t m_previous_synced = 0;
+		std::mutex m_sync_lock;
+#ifdef O_DIRECT
+		std::unique_ptr<direct_writer> m_direct;
+#endif
+#else
+		std::ofstream m_file;
+#endif
+	};
+
+	// read-only view over a whole file, memory-mapped on POSIX systems and loaded in memory elsewhere
+	class mapped_file
+	{
+	public:
+		mapped_file(const std::string& path)
+		{
+#ifdef CSV_POSIX
+			const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			struct stat file_stat;
+			if (fd < 0 || ::fstat(fd, &file_stat) != 0) {
+				if (fd >= 0) ::close(fd);
+				throw error::io_exception("Error while trying to open the specified path.");
+			}
+			m_size = static_cast<std::size_t>(file_stat.st_size);
+			if (m_size) {
+				void* address = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (address == MAP_FAILED) {
+					::close(fd);
+					throw error::io_exception("Error while trying to map the specified path.");
+				}
+				m_data = static_cast<const char*>(address);
+			}
+			::close(fd);
+#else
+			std::ifstream file(path, std::ios::binary);
+			if (!file.is_open()) {
+				throw error::io_exception("Error while trying to open the specified path.");
+			}
+			m_content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+			m_data = m_content.data();
+			m_size = m_content.size();
+#endif
+		}
+
+		~mapped_file() {
+#ifdef CSV_POSIX
+			if (m_data) ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+		}
+
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		const char* data() const { return m_data; }
+		std::size_t size() const { return m_size; }
+
+	private:
+		const char* m_data = nullptr;
+		std::size_t m_size = 0;
+#ifndef CSV_POSIX
+		std::string m_content;
+#endif
+	};
+
+	// read a field written by write_field, the counterpart of std::getline(buffer, field, delimiter)
+	// that also removes the quotes around a field and unescapes the doubled ones
+	static bool read_field(std::istream& buffer, std::string& field, const char delimiter)
+	{
+		if (buffer.peek() != '"') {
+			return static_cast<bool>(std::getline(buffer, field, delimiter));
+		}
+
+		field.clear();
+		buffer.get();
+		char c;
+		while (buffer.get(c)) {
+			if (c != '"') {
+				field.push_back(c);
+			}
+			else if (buffer.peek() == '"') {
+				field.push_back(buffer.get());
+			}
+			else {
+				if (buffer.peek() == delimiter) buffer.get();
+				break;
+			}
+		}
+		return true;
+	}
+
+	// field of a line starting at position, the string_view counterpart of read_field: unquoted fields are returned
+	// in place and quoted ones unescaped into scratch. position is moved past the delimiter, or to npos after the last field
+	static std::string_view next_field(std::string_view line, std::size_t& position, const char delimiter, std::string& scratch)
+	{
+		if (position >= line.size() || line[position] != '"') {
+			const std::size_t end = line.find(delimiter, position);
+			const std::string_view field = position < line.size() ? line.substr(position, end - position) : std::string_view();
+			position = end == std::string_view::npos ? std::string_view::npos : end + 1;
+			return field;
+		}
+
+		scratch.clear();
+		std::size_t i = position + 1;
+		for (; i < line.size(); i++) {
+			if (line[i] != '"') {
+				scratch.push_back(line[i]);
+			}
+			else if (i + 1 < line.size() && line[i + 1] == '"') {
+				scratch.push_back(line[++i]);
+			}
+			else {
+				break;
+			}
+		}
+		const std::size_t end = i < line.size() ? line.find(delimiter, i + 1) : std::string_view::npos;
+		position = end == std::string_view::npos ? std::string_view::npos : end + 1;
+		return scratch;
+	}
+
+	// header fields are written with write_field, so they are read back with read_field
+	static void read_header_from_buffer(std::stringstream& buffer, std::vector<std::string>& header, const char delimiter)
+	{
+		// get line
+		std::string header_line;
+		std::getline(buffer, header_line);
+
+		// parse line
+		std::stringstream stream(header_line);
+		std::string cell;
+		while (read_field(stream, cell, delimiter)) {
+			header.push_back(cell);
+		}
+	}
+
+	// sequential source of input blocks, returned in order. A block stays valid until the next call.
+	class block_source
+	{
+	public:
+		virtual ~block_source() = default;
+
+		// next block of input, empty once the input is exhausted
+		virtual std::string_view next() = 0;
+
+		// bytes of input left when the source knows it, 0 otherwise
+		virtual std::uint64_t size() const { return 0; }
+	};
+
+
+#ifdef CSV_POSIX
+	// bytes left to read in a regular file from its current offset, 0 for pipes, sockets and terminals
+	static std::uint64_t remaining_file_size(int fd)
+	{
+		struct stat status;
+		const off_t offset = ::lseek(fd, 0, SEEK_CUR);
+		if (offset < 0 || ::fstat(fd, &status) != 0 || !S_ISREG(status.st_mode) || status.st_size < offset) {
+			return 0;
+		}
+		return static_cast<std::uint64_t>(status.st_size - offset);
+	}
+
+	// reads a file descriptor through a ring of blocks kept in flight by a background thread, so that the
+	// parsing of a block overlaps with the reads of the next ones. Files are read from their current offset
+	// with positional reads, pipes and sockets with plain reads. Owned descriptors are closed on destruction.
+	class thread_block_reader : public block_source
+	{
+	public:
+		thread_block_reader(int fd, std::size_t block_size, std::size_t depth, bool owned = true)
+			: m_fd(fd), m_owned(owned), m_block_size(block_size), m_blocks(depth), m_size(remaining_file_size(fd))
+		{
+			const off_t offset = ::lseek(fd, 0, SEEK_CUR);
+			m_positional = offset >= 0;
+			m_offset = m_positional ? static_cast<std::uint64_t>(offset) : 0;
+			for (auto& block : m_blocks) {
+				block.data.reset(new char[block_size]);
+			}
+#ifndef NO_ASYNC
+			m_worker = std::thread([&]() { run(); });
+#endif
+		}
+
+		std::uint64_t size() const override { return m_size; }
+
+		~thread_block_reader() {
+#ifndef NO_ASYNC
+			{
+				std::lock_guard<std::mutex> lg(m_lock);
+				m_running = false;
+			}
+			m_cv.notify_all();
+			m_worker.join();
+#endif
+			if (m_owned) ::close(m_fd);
+		}
+
+		std::string_view next() override
+		{
+			if (m_finished) {
+				return {};
+			}
+#ifndef NO_ASYNC
+			std::unique_lock<std::mutex> ul(m_lock);
+			// the previous block is consumed, the reading thread can reuse it
+			if (m_consumed) {
+				m_blocks[(m_next - 1) % m_blocks.size()].ready = false;
+				m_cv.notify_all();
+			}
+			block& current = m_blocks[m_next % m_blocks.size()];
+			m_cv.wait(ul, [&] { return current.ready; });
+			m_consumed = true;
+			m_next++;
+			if (current.failed) {
+				throw error::io_exception("Error while trying to read the specified path.");
+			}
+			m_finished = !current.size;
+			return std::string_view(current.data.get(), current.size);
+#else
+			block& current = m_blocks.front();
+			current.size = read_block(current.data.get(), m_offset);
+			m_offset += current.size;
+			m_finished = !current.size;
+			return std::string_view(current.data.get(), current.size);
+#endif
+		}
+
+	private:
+		struct block {
+			std::unique_ptr<char[]> data;
+			std::size_t size = 0;
+			bool ready = false;
+			bool failed = false;
+		};
+
+		std::size_t read_block(char* data, std::uint64_t offset)
+		{
+			std::size_t size = 0;
+			while (size < m_block_size) {
+				const ssize_t length = m_positional
+					? ::pread(m_fd, data + size, m_block_size - size, static_cast<off_t>(offset + size))
+					: ::read(m_fd, data + size, m_block_size - size);
+				if (length < 0 && errno == EINTR) {
+					continue;
+				}
+				if (length < 0) {
+					throw error::io_exception("Error while trying to read the specified path.");
+				}
+				if (length == 0) {
+					break;
+				}
+				size += static_cast<std::size_t>(length);
+			}
+			return size;
+		}
+
+#ifndef NO_ASYNC
+		void run()
+		{
+			for (std::size_t index = 0; ; index++)
+			{
+				block& current = m_blocks[index % m_blocks.size()];
+				{
+					std::unique_lock<std::mutex> ul(m_lock);
+					m_cv.wait(ul, [&] { return !current.ready || !m_running; });
+					if (!m_running) return;
+				}
+
+				std::size_t size = 0;
+				bool failed = false;
+				try {
+					size = read_block(current.data.get(), m_offset);
+				}
+				catch (...) {
+					failed = true;
+				}
+				m_offset += size;
+
+				{
+					std::lock_guard<std::mutex> lg(m_lock);
+					current.size = size;
+					current.failed = failed;
+					current.ready = true;
+				}
+				m_cv.notify_all();
+				if (!size) return; // end of file (or failure) reported to the consumer
+			}
+		}
+#endif
+
+	private:
+		const int m_fd;
+		const bool m_owned;
+		const std::size_t m_block_size;
+		std::vector<block> m_blocks;
+		const std::uint64_t m_size;
+		bool m_positional = true;
+		std::uint64_t m_offset = 0;
+		std::size_t m_next = 0;
+		bool m_consumed = false;
+		bool m_finished = false;
+
+#ifndef NO_ASYNC
+		std::thread m_worker;
+		std::mutex m_lock;
+		std::condition_variable m_cv;
+		bool m_running = true;
+#endif
+	};
+#endif
+
+
+#ifdef CSV_IO_URING
+	// reads a file with io_uring: several block reads are kept in flight and handed to the consumer in order
+	// as they complete. Relies on raw system calls to avoid depending on liburing.
+	class uring_block_reader : public block_source
+	{
+	public:
+		// returns nullptr when io_uring is not available, e.g. old kernels or containers forbidding it
+		static std::unique_ptr<uring_block_reader> create(int fd, std::size_t block_size, std::size_t depth)
+		{
+			std::unique_ptr<uring_block_reader> reader(new uring_block_reader(fd, block_size, depth));
+			if (!reader->setup()) {
+				reader->m_fd = -1; // the file is still owned by the caller
+				return nullptr;
+			}
+			for (std::size_t i = 0; i < depth; i++) {
+				reader->submit(i);
+			}
+			return reader;
+		}
+
+		std::uint64_t size() const override { return m_size; }
+
+		~uring_block_reader()
+		{
+			// in-flight reads target our buffers, wait for them before releasing anything
+			while (m_in_flight && wait_completion()) {}
+			if (m_sq_ring != MAP_FAILED) ::munmap(m_sq_ring, m_sq_ring_size);
+			if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) ::munmap(m_cq_ring, m_cq_ring_size);
+			if (m_sqes != MAP_FAILED) ::munmap(m_sqes, m_sqes_size);
+			if (m_ring_fd >= 0) ::close(m_ring_fd);
+			if (m_fd >= 0) ::close(m_fd);
+		}
+
+		std::string_view next() override
+		{
+			// the previous block is consumed, reuse its buffer for the block depth positions ahead
+			if (m_next) {
+				submit(m_next - 1 + m_blocks.size());
+			}
+			block& current = m_blocks[m_next % m_blocks.size()];
+			while (!current.done) {
+				if (!wait_completion()) {
+					throw error::io_exception("Error while trying to read the specified path.");
+				}
+			}
+			if (current.failed) {
+				throw error::io_exception("Error while trying to read the specified path.");
+			}
+			// short reads before the end of file are completed synchronously
+			while (current.size < m_block_size && !current.eof) {
+				const ssize_t length = ::pread(m_fd, current.data.get() + current.size, m_block_size - current.size,
+					static_cast<off_t>(current.offset + current.size));
+				if (length < 0 && errno == EINTR) continue;
+				if (length < 0) throw error::io_exception("Error while trying to read the specified path.");
+				current.eof = length == 0;
+				current.size += static_cast<std::size_t>(length);
+			}
+			m_next++;
+			return std::string_view(current.data.get(), current.size);
+		}
+
+	private:
+		struct block {
+			std::unique_ptr<char[]> data;
+			iovec vector;
+			std::uint64_t offset = 0;
+			std::size_t size = 0;
+			bool done = false;
+			bool failed = false;
+			bool eof = false;
+		};
+
+		uring_block_reader(int fd, std::size_t block_size, std::size_t depth)
+			: m_fd(fd), m_block_size(block_size), m_blocks(depth), m_size(remaining_file_size(fd))
+		{
+			for (auto& block : m_blocks) {
+				block.data.reset(new char[block_size]);
+			}
+		}
+
+		bool setup()
+		{
+			io_uring_params params;
+			std::memset(&params, 0, sizeof(params));
+			m_ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, static_cast<unsigned>(m_blocks.size()), &params));
+			if (m_ring_fd < 0) {
+				return false;
+			}
+
+			m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			if (params.features & IORING_FEAT_SINGLE_MMAP) {
+				m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+			}
+			m_sq_ring = ::mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+			if (m_sq_ring == MAP_FAILED) {
+				return false;
+			}
+			m_cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? m_sq_ring
+				: ::mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+			m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+			m_sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+			if (m_cq_ring == MAP_FAILED || m_sqes == MAP_FAILED) {
+				return false;
+			}
+
+			char* sq = static_cast<char*>(m_sq_ring);
+			char* cq = static_cast<char*>(m_cq_ring);
+			m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+			m_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+			m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+			m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+			m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+			m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+			m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+			return true;
+		}
+
+		// queue the read of the index-th block of the file into its ring slot
+		void submit(std::size_t index)
+		{
+			block& target = m_blocks[index % m_blocks.size()];
+			target.offset = static_cast<std::uint64_t>(index) * m_block_size;
+			target.size = 0;
+			target.done = target.failed = target.eof = false;
+			target.vector.iov_base = target.data.get();
+			target.vector.iov_len = m_block_size;
+
+			const unsigned tail = *m_sq_tail;
+			const unsigned slot = tail & m_sq_mask;
+			io_uring_sqe& sqe = static_cast<io_uring_sqe*>(m_sqes)[slot];
+			std::memset(&sqe, 0, sizeof(sqe));
+			sqe.opcode = IORING_OP_READV;
+			sqe.fd = m_fd;
+			sqe.addr = reinterpret_cast<std::uint64_t>(&target.vector);
+			sqe.len = 1;
+			sqe.off = target.offset;
+			sqe.user_data = index % m_blocks.size();
+			m_sq_array[slot] = slot;
+			__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+			if (::syscall(__NR_io_uring_enter, m_ring_fd, 1, 0, 0, nullptr, 0) < 0) {
+				throw error::io_exception("Error while trying to read the specified path.");
+			}
+			m_in_flight++;
+		}
+
+		// wait for at least one completion and record all available ones
+		bool wait_completion()
+		{
+			unsigned head = *m_cq_head;
+			while (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+				if (::syscall(__NR_io_uring_enter, m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+					return false;
+				}
+			}
+			for (; head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE); head++) {
+				const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+				block& target = m_blocks[cqe.user_data];
+				target.done = true;
+				target.failed = cqe.res < 0;
+				target.size = cqe.res > 0 ? static_cast<std::size_t>(cqe.res) : 0;
+				target.eof = cqe.res == 0;
+				m_in_flight--;
+			}
+			__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+			return true;
+		}
+
+	private:
+		int m_fd;
+		const std::size_t m_block_size;
+		std::vector<block> m_blocks;
+		const std::uint64_t m_size;
+		std::size_t m_next = 0;
+		std::size_t m_in_flight = 0;
+
+		int m_ring_fd = -1;
+		void* m_sq_ring = MAP_FAILED;
+		void* m_cq_ring = MAP_FAILED;
+		void* m_sqes = MAP_FAILED;
+		std::size_t m_sq_ring_size = 0;
+		std::size_t m_cq_ring_size = 0;
+		std::size_t m_sqes_size = 0;
+
+		unsigned* m_sq_tail = nullptr;
+		unsigned m_sq_mask = 0;
+		unsigned* m_sq_array = nullptr;
+		unsigned* m_cq_head = nullptr;
+		unsigned* m_cq_tail = nullptr;
+		unsigned m_cq_mask = 0;
+		io_uring_cqe* m_cqes = nullptr;
+	};
+#endif
+
+
+	// reads a whole stream block by block on the calling thread
+	class stream_block_reader : public block_source
+	{
+	public:
+		stream_block_reader(std::istream& stream, std::size_t block_size)
+			: m_stream(stream), m_block(new char[block_size]), m_block_size(block_size)
+		{}
+
+		stream_block_reader(std::unique_ptr<std::istream> stream, std::size_t block_size)
+			: m_owned(std::move(stream)), m_stream(*m_owned), m_block(new char[block_size]), m_block_size(block_size)
+		{}
+
+		std::string_view next() override
+		{
+			m_stream.read(m_block.get(), static_cast<std::streamsize>(m_block_size));
+			if (m_stream.bad()) {
+				throw error::io_exception("Error while trying to read the input stream.");
+			}
+			return std::string_view(m_block.get(), static_cast<std::size_t>(m_stream.gcount()));
+		}
+
+	private:
+		std::unique_ptr<std::istream> m_owned;
+		std::istream& m_stream;
+		std::unique_ptr<char[]> m_block;
+		const std::size_t m_block_size;
+	};
+
+
+	// hands back a block already taken from a source before reading the following ones
+	class replay_source : public block_source
+	{
+	public:
+		replay_source(std::unique_ptr<block_source> source, std::string_view first)
+			: m_source(std::move(source)), m_first(first)
+		{}
+
+		std::string_view next() override
+		{
+			if (m_replayed) {
+				return m_source->next();
+			}
+			m_replayed = true;
+			return m_first;
+		}
+
+		std::uint64_t size() const override { return m_source->size(); }
+
+	private:
+		std::unique_ptr<block_source> m_source;
+		const std::string_view m_first;
+		bool m_replayed = false;
+	};
+
+
+	constexpr std::size_t read_block_size = 1 << 20;
+	constexpr std::size_t read_ahead_depth = 4;
+
+	// open a file as a source of blocks read ahead of the consumer: io_uring when available,
+	// otherwise a reading thread, or plain blocking reads on platforms without POSIX files
+	static std::unique_ptr<block_source> open_block_source
+	(
+		const std::string& path,
+		std::size_t block_size = read_block_size,
+		std::size_t depth = read_ahead_depth
+	) {
+#ifdef CSV_POSIX
+		const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			throw error::io_exception("Error while trying to open the specified path.");
+		}
+#ifdef __linux__
+		::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#ifdef CSV_IO_URING
+		if (auto reader = uring_block_reader::create(fd, block_size, depth)) {
+			return reader;
+		}
+#endif
+		return std::make_unique<thread_block_reader>(fd, block_size, depth);
+#else
+		auto file = std::make_unique<std::ifstream>(path, std::ios::binary);
+		if (!file->is_open()) {
+			throw error::io_exception("Error while trying to open the specified path.");
+		}
+		return std::make_unique<stream_block_reader>(std::move(file), block_size);
+#endif
+	}
+
+	// decompresses the blocks of another source, on a background thread that stays a few blocks ahead of the consumer
+	class decompressing_source : public block_source
+	{
+	public:
+		decompressing_source(std::unique_ptr<block_source> source, std::unique_ptr<decoder> decoder,
+			std::size_t block_size = read_block_size, std::size_t depth = read_ahead_depth)
+			: m_source(std::move(source)), m_decoder(std::move(decoder)), m_block_size(block_size), m_depth(depth)
+		{
+#ifndef NO_ASYNC
+			m_worker = std::thread([&]() { run(); });
+#endif
+		}
+
+		~decompressing_source() {
+#ifndef NO_ASYNC
+			{
+				std::lock_guard<std::mutex> lg(m_lock);
+				m_running = false;
+			}
+			m_cv.notify_all();
+			m_worker.join();
+#endif
+		}
+
+		std::string_view next() override
+		{
+#ifndef NO_ASYNC
+			std::unique_lock<std::mutex> ul(m_lock);
+			m_cv.wait(ul, [&] { return !m_blocks.empty() || m_finished; });
+			if (m_blocks.empty()) {
+				if (m_exception) std::rethrow_exception(m_exception);
+				return {};
+			}
+			m_current = std::move(m_blocks.front());
+			m_blocks.pop_front();
+			ul.unlock();
+			m_cv.notify_all();
+			return m_current;
+#else
+			m_current = decode_block();
+			return m_current;
+#endif
+		}
+
+	private:
+		// next block of decompressed data, empty at the end of the input
+		std::string decode_block()
+		{
+			std::string block(m_block_size, '\0');
+			std::size_t size = 0;
+			while (size < m_block_size)
+			{
+				if (m_input.empty() && !m_input_finished) {
+					m_input = m_source->next();
+					m_input_finished = m_input.empty();
+				}
+				const std::size_t produced = m_decoder->decode(m_input, &block[size], m_block_size - size);
+				size += produced;
+				if (!produced && m_input_finished) {
+					if (!m_decoder->complete()) {
+						throw error::io_exception("Error while trying to decompress data: truncated input.");
+					}
+					break;
+				}
+			}
+			block.resize(size);
+			return block;
+		}
+
+#ifndef NO_ASYNC
+		void run()
+		{
+			try {
+				while (true)
+				{
+					std::string block = decode_block();
+					std::unique_lock<std::mutex> ul(m_lock);
+					if (block.empty() || !m_running) break;
+					m_blocks.push_back(std::move(block));
+					m_cv.notify_all();
+					m_cv.wait(ul, [&] { return m_blocks.size() < m_depth || !m_running; });
+				}
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lg(m_lock);
+				m_exception = std::current_exception();
+			}
+			std::lock_guard<std::mutex> lg(m_lock);
+			m_finished = true;
+			m_cv.notify_all();
+		}
+#endif
+
+	private:
+		std::unique_ptr<block_source> m_source;
+		std::unique_ptr<decoder> m_decoder;
+		const std::size_t m_block_size;
+		const std::size_t m_depth;
+		std::string_view m_input;
+		bool m_input_finished = false;
+		std::string m_current;
+
+#ifndef NO_ASYNC
+		std::thread m_worker;
+		std::mutex m_lock;
+		std::condition_variable m_cv;
+		std::deque<std::string> m_blocks;
+		std::exception_ptr m_exception;
+		bool m_running = true;
+		bool m_finished = false;
+#endif
+	};
+
+
+	// decompresses the independent frames of a mapped file on several threads, frames are returned in order
+	// and workers never get more than a window of frames ahead of the consumer
+	class parallel_decompressing_source : public block_source
+	{
+	public:
+		parallel_decompressing_source(std::unique_ptr<mapped_file> file, std::vector<std::string_view> frames,
+			Compression compression, std::size_t threads)
+			: m_file(std::move(file)), m_frames(std::move(frames)), m_compression(compression), m_window(2 * threads)
+		{
+			m_slots.resize(m_window);
+#ifndef NO_ASYNC
+			for (std::size_t i = 0; i < threads; i++) {
+				m_pool.push_back(std::thread([&]() { run(); }));
+			}
+#endif
+		}
+
+		~parallel_decompressing_source() {
+#ifndef NO_ASYNC
+			{
+				std::lock_guard<std::mutex> lg(m_lock);
+				m_running = false;
+			}
+			m_cv.notify_all();
+			for (auto& thread : m_pool) {
+				thread.join();
+			}
+#endif
+		}
+
+		std::string_view next() override
+		{
+			if (m_next == m_frames.size()) {
+				return {};
+			}
+#ifndef NO_ASYNC
+			std::unique_lock<std::mutex> ul(m_lock);
+			slot& current = m_slots[m_next % m_window];
+			m_cv.wait(ul, [&] { return current.ready; });
+			// the slot is reused for the frame a window ahead as soon as it is released
+			std::exception_ptr exception = std::move(current.exception);
+			m_current = std::move(current.data);
+			current = slot();
+			m_next++;
+			ul.unlock();
+			m_cv.notify_all();
+			if (exception) {
+				std::rethrow_exception(exception);
+			}
+#else
+			m_current = decode_frame(m_frames[m_next++]);
+#endif
+			// frames decompressing into nothing, e.g. zstd skippable frames, must not be taken for the end
+			return m_current.empty() ? next() : std::string_view(m_current);
+		}
+
+	private:
+		struct slot {
+			std::string data;
+			std::exception_ptr exception;
+			bool ready = false;
+		};
+
+		std::string decode_frame(std::string_view frame) const
+		{
+			auto decoder = make_decoder(m_compression);
+			std::string data;
+			std::size_t size = 0;
+			while (true)
+			{
+				if (size == data.size()) {
+					data.resize(std::max<std::size_t>(2 * data.size(), 1 << 16));
+				}
+				const std::size_t remaining = frame.size();
+				const std::size_t produced = decoder->decode(frame, &data[size], data.size() - size);
+				size += produced;
+				if (!produced && frame.size() == remaining) break;
+			}
+			if (!decoder->complete()) {
+				throw error::io_exception("Error while trying to decompress data: truncated input.");
+			}
+			data.resize(size);
+			return data;
+		}
+
+#ifndef NO_ASYNC
+		void run()
+		{
+			while (true)
+			{
+				std::size_t index;
+				{
+					std::unique_lock<std::mutex> ul(m_lock);
+					m_cv.wait(ul, [&] { return m_claimed < m_next + m_window || !m_running; });
+					if (!m_running || m_claimed == m_frames.size()) return;
+					index = m_claimed++;
+				}
+
+				slot result;
+				try {
+					result.data = decode_frame(m_frames[index]);
+				}
+				catch (...) {
+					result.exception = std::current_exception();
+				}
+
+				{
+					std::lock_guard<std::mutex> lg(m_lock);
+					m_slots[index % m_window] = std::move(result);
+					m_slots[index % m_window].ready = true;
+				}
+				m_cv.notify_all();
+			}
+		}
+#endif
+
+	private:
+		std::unique_ptr<mapped_file> m_file;
+		const std::vector<std::string_view> m_frames;
+		const Compression m_compression;
+		const std::size_t m_window;
+		std::vector<slot> m_slots;
+		std::size_t m_next = 0;
+		std::string m_current;
+
+#ifndef NO_ASYNC
+		std::vector<std::thread> m_pool;
+		std::mutex m_lock;
+		std::condition_variable m_cv;
+		std::size_t m_claimed = 0;
+		bool m_running = true;
+#endif
+	};
+
+
+	// open a file as a source of blocks, decompressed when the file starts with a gzip or zstd magic number.
+	// files made of several members or frames of known size are decompressed in parallel
+	static std::unique_ptr<block_source> open_input_source
+	(
+		const std::string& path,
+		std::size_t block_size = read_block_size,
+		std::size_t depth = read_ahead_depth
+	) {
+		const Compression compression = detect_compression(path);
+		if (compression == Compression::NONE) {
+			return open_block_source(path, block_size, depth);
+		}
+
+		auto file = std::make_unique<mapped_file>(path);
+		std::vector<std::string_view> frames = find_frames(compression, std::string_view(file->data(), file->size()));
+#ifndef NO_ASYNC
+		if (frames.size() > 1) {
+			const std::size_t threads = std::min<std::size_t>(thread_num, frames.size());
+			return std::make_unique<parallel_decompressing_source>(std::move(file), std::move(frames), compression, threads);
+		}
+#endif
+		file.reset();
+		return std::make_unique<decompressing_source>(open_block_source(path, block_size, depth), make_decoder(compression), block_size, depth);
+	}
+
+	// decompress a source when its first bytes are those of a gzip or zstd stream, for inputs that cannot be
+	// mapped or seeked like pipes. Decompression then overlaps with parsing but is not parallel.
+	static std::unique_ptr<block_source> decompress_source(std::unique_ptr<block_source> source)
+	{
+		const std::string_view first = source->next();
+		const Compression compression = detect_compression(first);
+		auto replay = std::make_unique<replay_source>(std::move(source), first);
+		if (compression == Compression::NONE) {
+			return replay;
+		}
+		return std::make_unique<decompressing_source>(std::move(replay), make_decoder(compression));
+	}
+
+#ifdef CSV_POSIX
+	// open a file descriptor (stdin, a pipe, a socket...) as a source of blocks read ahead by a background thread.
+	// the descriptor is not closed
+	static std::unique_ptr<block_source> open_fd_source
+	(
+		int fd,
+		std::size_t block_size = read_block_size,
+		std::size_t depth = read_ahead_depth
+	) {
+		return decompress_source(std::make_unique<thread_block_reader>(fd, block_size, depth, false));
+	}
+#endif
+
+	static std::unique_ptr<block_source> open_stream_source(std::istream& stream, std::size_t block_size = read_block_size)
+	{
+		return decompress_source(std::make_unique<stream_block_reader>(stream, block_size));
+	}
+
+	// first line of a file, without its line break. Compressed files are decompressed
+	static std::string read_first_line(const std::string& path)
+	{
+		auto source = open_input_source(path, 1 << 12, 1);
+		std::string line;
+		for (std::string_view block = source->next(); !block.empty(); block = source->next()) {
+			const std::size_t end = block.find('\n');
+			line.append(block.substr(0, end));
+			if (end != std::string_view::npos) break;
+		}
+		return line;
+	}
+
+	// true if the file does not end with a line break, for uncompressed files
+	static bool misses_final_line_break(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		char last = '\n';
+		if (file.seekg(-1, std::ios::end)) {
+			file.get(last);
+		}
+		return last != '\n';
+	}
+
+	// split the blocks of a source into chunks of complete lines of about chunk_size bytes, in input order.
+	// the header line is parsed first, lines cut between two blocks are carried over to the next chunk.
+	template <typename CALLBACK>
+	static void split_source_into_chunks
+	(
+		block_source& source,
+		std::vector<std::string>& header,
+		const char delimiter,
+		const std::size_t chunk_size,
+		CALLBACK&& on_chunk,
+		read_stats* stats = nullptr
+	) {
+		std::string pending; // unterminated line of the previous blocks
+		bool header_read = false;
+
+		const auto next_block = [&] {
+			stage_timer load(stats ? &stats->load : nullptr);
+			const std::string_view block = source.next();
+			if (stats) stats->bytes += block.size();
+			return block;
+		};
+
+		for (std::string_view block = next_block(); !block.empty(); block = next_block())
+		{
+			stage_timer split(stats ? &stats->split : nullptr);
+			if (!header_read) {
+				const std::size_t end = block.find('\n');
+				if (end == std::string_view::npos) {
+					pending.append(block);
+					continue;
+				}
+				pending.append(block.substr(0, end + 1));
+				std::stringstream line(std::move(pending));
+				read_header_from_buffer(line, header, delimiter);
+				pending.clear();
+				header_read = true;
+				block.remove_prefix(end + 1);
+			}
+
+			while (!block.empty())
+			{
+				const std::size_t end = block.find('\n', std::min(chunk_size, block.size()) - 1);
+				if (end == std::string_view::npos) {
+					pending.append(block);
+					break;
+				}
+				pending.append(block.substr(0, end + 1));
+				std::stringstream chunk(std::move(pending));
+				pending.clear();
+				if (stats) stats->estimated_allocations++;
+				block.remove_prefix(end + 1);
+				split.stop();
+				on_chunk(std::move(chunk));
+				split.start(stats ? &stats->split : nullptr);
+			}
+		}
+
+		if (!header_read) {
+			std::stringstream line(std::move(pending));
+			read_header_from_buffer(line, header, delimiter);
+		}
+		else if (!pending.empty()) {
+			if (stats) stats->estimated_allocations++;
+			on_chunk(std::stringstream(std::move(pending)));
+		}
+	}
+
+	// true if a field contains the delimiter, a quote or a line break and has to be quoted (RFC 4180).
+	// fields are scanned 16 bytes at a time with SSE2 and 8 bytes at a time elsewhere.
+	static bool needs_quoting(std::string_view field, const char delimiter)
+	{
+		const char* data = field.data();
+		std::size_t size = field.size();
+
+#ifdef CSV_SSE2
+		const __m128i delimiters = _mm_set1_epi8(delimiter);
+		const __m128i quotes = _mm_set1_epi8('"');
+		const __m128i line_feeds = _mm_set1_epi8('\n');
+		const __m128i carriage_returns = _mm_set1_epi8('\r');
+		for (; size >= 16; data += 16, size -= 16) {
+			const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+			const __m128i matches = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(chars, delimiters), _mm_cmpeq_epi8(chars, quotes)),
+				_mm_or_si128(_mm_cmpeq_epi8(chars, line_feeds), _mm_cmpeq_epi8(chars, carriage_returns)));
+			if (_mm_movemask_epi8(matches)) {
+				return true;
+			}
+		}
+#endif
+
+		// a byte of x is equal to c when the same byte of x ^ broadcast(c) is zero
+		constexpr std::uint64_t ones = 0x0101010101010101ull;
+		constexpr std::uint64_t highs = 0x8080808080808080ull;
+		auto has_byte = [](std::uint64_t word, unsigned char c) {
+			const std::uint64_t x = word ^ (ones * c);
+			return ((x - ones) & ~x & highs) != 0;
+		};
+		for (; size >= 8; data += 8, size -= 8) {
+			std::uint64_t word;
+			std::memcpy(&word, data, 8);
+			if (has_byte(word, static_cast<unsigned char>(delimiter)) || has_byte(word, '"') || has_byte(word, '\n') || has_byte(word, '\r')) {
+				return true;
+			}
+		}
+		for (; size; data++, size--) {
+			if (*data == delimiter || *data == '"' || *data == '\n' || *data == '\r') {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// write a field, quoted with its quotes doubled only when it needs to be, otherwise copied as is
+	static void write_field(std::ostream& buffer, std::string_view field, const char delimiter)
+	{
+		if (!needs_quoting(field, delimiter)) {
+			buffer.write(field.data(), static_cast<std::streamsize>(field.size()));
+			return;
+		}
+
+		buffer.put('"');
+		for (std::size_t quote; (quote = field.find('"')) != std::string_view::npos; field.remove_prefix(quote + 1)) {
+			buffer.write(field.data(), static_cast<std::streamsize>(quote + 1)).put('"');
+		}
+		buffer.write(field.data(), static_cast<std::streamsize>(field.size())).put('"');
+	}
+
+
+	// -----------------
+	// [ SECTION ] TYPES
+	// -----------------
+
+
+	// slab allocator owning the characters of string_view cells, so that the text of a document
+	// is stored in a few large allocations and released at once with it
+	class string_arena
+	{
+		static constexpr std::size_t slab_size = 1 << 16;
+	public:
+		string_arena() = default;
+		string_arena(const string_arena&) = delete;
+		string_arena& operator=(const string_arena&) = delete;
+
+		// copy a cell into the arena, the returned view lives as long as the arena
+		std::string_view store(std::string_view cell)
+		{
+			if (cell.size() > m_available) {
+				// large cells get their own block so that the current slab is not wasted
+				if (cell.size() > slab_size / 4) {
+					m_slabs.push_back(std::make_unique<char[]>(cell.size()));
+					m_bytes += cell.size();
+					std::memcpy(m_slabs.back().get(), cell.data(), cell.size());
+					return std::string_view(m_slabs.back().get(), cell.size());
+				}
+				m_slabs.push_back(std::make_unique<char[]>(slab_size));
+				m_bytes += slab_size;
+				m_cursor = m_slabs.back().get();
+				m_available = slab_size;
+			}
+			if (cell.empty()) {
+				return std::string_view();
+			}
+			std::memcpy(m_cursor, cell.data(), cell.size());
+			std::string_view stored(m_cursor, cell.size());
+			m_cursor += cell.size();
+			m_available -= cell.size();
+			return stored;
+		}
+
+		bool empty() const { return m_slabs.empty(); }
+		std::size_t slabs() const { return m_slabs.size(); }
+		std::size_t allocated_bytes() const { return m_bytes; }
+
+	private:
+		std::vector<std::unique_ptr<char[]>> m_slabs;
+		char* m_cursor = nullptr;
+		std::size_t m_available = 0;
+		std::size_t m_bytes = 0;
+	};
+
+	// stream handed to the prototypes deserialize method, refilled line after line so that
+	// the readers do not allocate a string and a stream per line once its buffers have grown
+	class line_stream
+	{
+	public:
+		std::stringstream& reset(std::string_view line)
+		{
+			m_line.assign(line.data(), line.size());
+			m_stream.str(m_line);
+			m_stream.clear();
+			// formatting set by the previous line does not leak into the next one
+			m_stream.flags(m_flags);
+			m_stream.width(0);
+			m_stream.precision(m_precision);
+			return m_stream;
+		}
+
+	private:
+		std::string m_line;
+		std::stringstream m_stream;
+		const std::ios_base::fmtflags m_flags = m_stream.flags();
+		const std::streamsize m_precision = m_stream.precision();
+	};
+
+	// append-only byte buffer supplied by the writers to the prototypes serialize method
+	class output_buffer
+	{
+	public:
+		output_buffer(const char delimiter = ',', std::size_t capacity = 1 << 16)
+			: m_delimiter(delimiter)
+		{
+			m_bytes.reserve(capacity);
+		}
+
+		void append(std::string_view bytes) { m_bytes.append(bytes.data(), bytes.size()); }
+		void append(const char c) { m_bytes.push_back(c); }
+
+		// same text as std::ostream << value with the default formatting, without streams nor locales
+		template <typename T>
+		void append_number(T value)
+		{
+			static_assert(std::is_arithmetic_v<T>, "append_number expects an arithmetic type.");
+			char digits[64];
+			std::to_chars_result result;
+			if constexpr (std::is_floating_point_v<T>) {
+				result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 6);
+			}
+			else if constexpr (std::is_same_v<T, bool>) {
+				result = std::to_chars(digits, digits + sizeof(digits), static_cast<int>(value));
+			}
+			else if constexpr (std::is_same_v<T, char> || std::is_same_v<T, signed char> || std::is_same_v<T, unsigned char>) {
+				// streamed as characters, not as numbers
+				m_bytes.push_back(static_cast<char>(value));
+				return;
+			}
+			else {
+				result = std::to_chars(digits, digits + sizeof(digits), value);
+			}
+			m_bytes.append(digits, result.ptr);
+		}
+
+		// text field, quoted only if it contains the delimiter, quotes or line breaks
+		void append_field(std::string_view field)
+		{
+			if (!needs_quoting(field, m_delimiter)) {
+				append(field);
+				return;
+			}
+			m_bytes.push_back('"');
+			for (std::size_t quote; (quote = field.find('"')) != std::string_view::npos; field.remove_prefix(quote + 1)) {
+				m_bytes.append(field.data(), quote + 1).push_back('"');
+			}
+			m_bytes.append(field.data(), field.size()).push_back('"');
+		}
+
+		void append_delimiter() { m_bytes.push_back(m_delimiter); }
+		void end_row() { m_bytes.push_back('\n'); }
+
+		// extend the buffer by size bytes and return where they start, to be filled by the caller
+		char* grow(std::size_t size) {
+			m_bytes.resize(m_bytes.size() + size);
+			return &m_bytes[m_bytes.size() - size];
+		}
+
+		const char* data() const { return m_bytes.data(); }
+		std::size_t size() const { return m_bytes.size(); }
+		std::string_view view() const { return m_bytes; }
+		char delimiter() const { return m_delimiter; }
+
+		void resize(std::size_t size) { m_bytes.resize(size); }
+		void clear() { m_bytes.clear(); }
+
+	private:
+		std::string m_bytes;
+		const char m_delimiter;
+	};
+
+	static void write_header_into_buffer(output_buffer& buffer, const std::vector<std::string>& header)
+	{
+		for (std::size_t i = 0; i < header.size(); i++) {
+			if (i) buffer.append_delimiter();
+			buffer.append_field(header[i]);
+		}
+		if (header.size()) {
+			buffer.end_row();
+		}
+	}
+
+	// Template base class used to create user-defined prototypes
+	// Prototypes are passed to read & write function to deserialize and serialize any user-defined types
+	template<typename DATA_TYPE>
+	class prototype {
+	public:
+		virtual void serialize(std::stringstream& buffer, const DATA_TYPE& data) const {
+			throw std::logic_error("The method or operation is not implemented.");
+		};
+
+		// serialize into the byte buffer of the writers. The default implementation adapts
+		// serialize(std::stringstream&), override it to skip iostreams altogether. Derived prototypes
+		// overriding a single overload hide the other, `using prototype<DATA_TYPE>::serialize;` brings it back
+		virtual void serialize(output_buffer& buffer, const DATA_TYPE& data) const {
+			// the stream is rewound rather than reallocated, rows only cost a copy once it has grown
+			thread_local std::stringstream stream;
+			stream.clear();
+			stream.seekp(0);
+			stream.seekg(0);
+			serialize(stream, data);
+			const std::size_t size = static_cast<std::size_t>(stream.tellp());
+			stream.read(buffer.grow(size), static_cast<std::streamsize>(size));
+		}
+		virtual DATA_TYPE deserialize(std::stringstream& buffer) const {
+			throw std::logic_error("The method or operation is not implemented.");
+		}
+		virtual inline const char get_delimiter() const { return ','; }
+
+		// arena used by store(), bound by the readers before deserializing
+		void bind_arena(string_arena* arena) { m_arena = arena; }
+	protected:
+		prototype() = default;
+
+		// copy a cell into the arena of the document being read, for std::string_view members
+		std::string_view store(std::string_view cell) const {
+			if (!m_arena) {
+				throw std::logic_error("No string arena is bound to the prototype.");
+			}
+			return m_arena->store(cell);
+		}
+
+	private:
+		string_arena* m_arena = nullptr;
+	};
+
+	// static check for user user-defined prototypes
+#define CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE) static_assert(std::is_base_of<prototype<DATA_TYPE>, CUSTOM_PROTOTYPE>::value, "CUSTOM_PROTOTYPE should derive from csv::prototype.");
+
+	// the object returned when reading csv files
+	template <typename DATA_TYPE>
+	struct Document {
+		std::vector<std::string> header;
+		std::vector<DATA_TYPE> rows;
+
+		// storage of the std::string_view cells, shared by copies of the document
+		std::vector<std::shared_ptr<string_arena>> arenas;
+	};
+
+	// counters known once the document is complete
+	template <typename DATA_TYPE>
+	static void finish_stats(read_stats* stats, const Document<DATA_TYPE>& document)
+	{
+		if (!stats) {
+			return;
+		}
+		stats->rows = document.rows.size();
+		for (const auto& arena : document.arenas) {
+			stats->estimated_allocations += arena->slabs();
+			stats->arena_bytes += arena->allocated_bytes();
+		}
+	}
+
+
+	// -----------------------------------
+	// [ SECTION ] Read & Write functions
+	// -----------------------------------
+
+
+	// linearly read and deserialize data from csv file, slower than the read_async_from_folder method
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_from_buffer
+	(
+		std::stringstream& buffer,
+		read_stats* stats = nullptr
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+			CUSTOM_PROTOTYPE proto;
+		stats = start_stats(stats);
+		stage_timer total(stats ? &stats->total : nullptr);
+		stage_timer parse(stats ? &stats->parse : nullptr);
+		if (stats) stats->bytes = remaining_bytes(buffer);
+
+		auto doc = std::make_unique<Document<DATA_TYPE>>();
+		auto arena = std::make_shared<string_arena>();
+		proto.bind_arena(arena.get());
+
+		read_header_from_buffer(buffer, doc->header, proto.get_delimiter());
+
+		// fill rows
+		std::string line;
+		line_stream lines;
+		while (std::getline(buffer, line))
+		{
+			doc->rows.push_back(proto.deserialize(lines.reset(line)));
+		}
+		parse.stop();
+		trace_phase(stats, "parse", stats ? stats->start : std::chrono::steady_clock::time_point(), stats ? stats->bytes : 0, doc->rows.size());
+
+		if (!arena->empty()) {
+			doc->arenas.push_back(std::move(arena));
+		}
+		finish_stats(stats, *doc);
+		return doc;
+	}
+
+
+	// linearly read and deserialize data from a source of blocks, the next blocks being read while the current one is parsed
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_from_source
+	(
+		block_source& source,
+		read_stats* stats = nullptr
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+			CUSTOM_PROTOTYPE proto;
+		stats = start_stats(stats);
+		stage_timer total(stats ? &stats->total : nullptr);
+
+		auto doc = std::make_unique<Document<DATA_TYPE>>();
+		auto arena = std::make_shared<string_arena>();
+		proto.bind_arena(arena.get());
+		std::string line;
+		line_stream lines;
+
+		split_source_into_chunks(source, doc->header, proto.get_delimiter(), read_block_size, [&](std::stringstream chunk) {
+			stage_timer parse(stats ? &stats->parse : nullptr);
+			const auto start = std::chrono::steady_clock::now();
+			const std::uint64_t bytes = stats && stats->trace ? remaining_bytes(chunk) : 0;
+			const std::size_t row_count = doc->rows.size();
+			if (stats) stats->chunks++;
+			while (std::getline(chunk, line))
+			{
+				doc->rows.push_back(proto.deserialize(lines.reset(line)));
+			}
+			trace_phase(stats, "chunk", start, bytes, doc->rows.size() - row_count);
+		}, stats);
+
+		if (!arena->empty()) {
+			doc->arenas.push_back(std::move(arena));
+		}
+		finish_stats(stats, *doc);
+		return doc;
+	}
+
+
+	// serialize rows into a reusable buffer that is written to the file each time it fills up,
+	// so that rows can be pushed incrementally with a memory use that does not depend on the output size
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	class stream_writer
+	{
+	public:
+		stream_writer
+		(
+			const std::string& filename,
+			const std::vector<std::string>& header = {},
+			const write_options& options = {}
+		)
+			: m_file(filename, options), m_buffer(CUSTOM_PROTOTYPE().get_delimiter(), options.buffer_size), m_capacity(options.buffer_size)
+		{
+			CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+			write_header_into_buffer(m_buffer, header);
+
+			// when appending to a non-empty file, its header is checked once instead of being written again
+			if (m_file.initial_size()) {
+				if (detect_compression(filename) != options.compression) {
+					throw error::io_exception("The compression does not match the compression of the file to append to.");
+				}
+				if (header.size()) {
+					const std::string existing_line = read_first_line(filename);
+					if (existing_line + '\n' != m_buffer.view()) {
+						throw error::header_mismatch("The header does not match the header of the file to append to.");
+					}
+				}
+				m_buffer.clear();
+				// the first appended row would otherwise continue the last line of the file
+				if (options.compression == Compression::NONE && misses_final_line_break(filename)) {
+					m_buffer.end_row();
+				}
+			}
+		}
+
+		// flush the remaining rows, errors can only be caught by calling close() explicitly.
+		// when destroyed by an exception the output is left incomplete, atomic writes leave the target untouched.
+		~stream_writer() {
+			if (std::uncaught_exceptions() > m_uncaught_exceptions) {
+				return;
+			}
+			try {
+				close();
+			}
+			catch (...) {}
+		}
+
+		stream_writer(const stream_writer&) = delete;
+		stream_writer& operator=(const stream_writer&) = delete;
+
+		void push(const DATA_TYPE& row)
+		{
+			const std::size_t size = m_buffer.size();
+			try {
+				static_cast<const prototype<DATA_TYPE>&>(m_prototype).serialize(m_buffer, row);
+			}
+			catch (...) {
+				m_buffer.resize(size); // never write a partially serialized row
+				throw;
+			}
+			if (m_buffer.size() >= m_capacity) {
+				flush();
+			}
+		}
+
+		template <typename ITERATOR>
+		void push(ITERATOR first, ITERATOR last)
+		{
+			for (; first != last; ++first) {
+				push(*first);
+			}
+		}
+
+		// write the buffered rows into the file
+		void flush()
+		{
+			m_file.write(m_buffer.data(), m_buffer.size());
+			m_buffer.clear();
+		}
+
+		void close()
+		{
+			if (m_closed) {
+				return;
+			}
+			m_closed = true;
+			flush();
+			m_file.close();
+		}
+
+	private:
+		output_file m_file;
+		CUSTOM_PROTOTYPE m_prototype;
+
+		output_buffer m_buffer;
+		const std::size_t m_capacity;
+		bool m_closed = false;
+		const int m_uncaught_exceptions = std::uncaught_exceptions();
+	};
+
+
+	// linearly serialize data to file using a prototype. The header can be omitted to only save rows to file.
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static void write
+	(
+		const std::string filename,
+		const std::vector<DATA_TYPE>& rows,
+		const std::vector<std::string>& header = {},
+		const write_options& options = {}
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+			stream_writer<DATA_TYPE, CUSTOM_PROTOTYPE> writer(filename, header, options);
+		writer.push(rows.begin(), rows.end());
+		writer.close();
+	}
+
+
+	// append rows to a file in large batched writes, the header is written if the file is empty
+	// and otherwise checked against the first line of the file
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static void append
+	(
+		const std::string filename,
+		const std::vector<DATA_TYPE>& rows,
+		const std::vector<std::string>& header = {},
+		write_options options = {}
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+			options.append = true;
+		write<DATA_TYPE, CUSTOM_PROTOTYPE>(filename, rows, header, options);
+	}
+
+
+#ifndef NO_ASYNC
+
+	static std::exception_ptr thread_exception = nullptr;
+
+	// check for exception during the parsing
+	static void CheckForThreadException() {
+		if (thread_exception) {
+			try {
+				std::rethrow_exception(thread_exception);
+			}
+			catch (const std::exception& ex)
+			{
+				std::stringstream msg;
+				msg << "An error occurred while parsing the csv file: ";
+				msg << ex.what();
+				throw std::runtime_error(msg.str());
+			}
+		}
+	}
+
+
+	// bounded single-producer single-consumer ring of slots. Each side only writes its own index and reads the
+	// other one with acquire ordering, so a slot is published by the release store of the tail and handed back
+	// by the release store of the head. Both sides cache the other index to only reload it when they catch up.
+	template <typename T>
+	class spsc_ring
+	{
+	public:
+		explicit spsc_ring(std::size_t capacity)
+		{
+			std::size_t size = 1;
+			while (size < capacity) size <<= 1;
+			m_slots.resize(size);
+			m_mask = size - 1;
+		}
+
+		spsc_ring(const spsc_ring&) = delete;
+		spsc_ring& operator=(const spsc_ring&) = delete;
+
+		// producer side: moves value into the ring, leaving it untouched when the ring is full
+		bool try_push(T& value)
+		{
+			const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail - m_head_cache == m_slots.size()) {
+				m_head_cache = m_head.load(std::memory_order_acquire);
+				if (tail - m_head_cache == m_slots.size()) {
+					return false;
+				}
+			}
+			m_slots[tail & m_mask] = std::move(value);
+			m_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// consumer side: oldest slot, nullptr when the ring is empty
+		T* front()
+		{
+			const std::size_t head = m_head.load(std::memory_order_relaxed);
+			if (head == m_tail_cache) {
+				m_tail_cache = m_tail.load(std::memory_order_acquire);
+				if (head == m_tail_cache) {
+					return nullptr;
+				}
+			}
+			return &m_slots[head & m_mask];
+		}
+
+		// consumer side: release the oldest slot, resetting it so that its buffers are freed now
+		void pop()
+		{
+			const std::size_t head = m_head.load(std::memory_order_relaxed);
+			m_slots[head & m_mask] = T();
+			m_head.store(head + 1, std::memory_order_release);
+		}
+
+		// slots in use, exact from the producer side once its pushes are counted
+		std::size_t size() const
+		{
+			return m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_acquire);
+		}
+
+	private:
+		std::vector<T> m_slots;
+		std::size_t m_mask = 0;
+
+		// indices on their own cache lines, next to the cache of the side writing them
+		alignas(64) std::atomic<std::size_t> m_head{ 0 };
+		std::size_t m_tail_cache = 0;
+		alignas(64) std::atomic<std::size_t> m_tail{ 0 };
+		std::size_t m_head_cache = 0;
+	};
+
+	// most chunks a worker can have waiting, whatever the in-flight limit
+	constexpr std::size_t chunk_queue_capacity = 1 << 6;
+
+
+	// bounds the chunks and bytes handed to the workers and not parsed yet. The producer charges each chunk
+	// before handing it over and waits while the bounds are reached, yielding first then sleeping. Workers
+	// release their chunks once parsed. A chunk always fits when nothing is in flight, whatever its size
+	class in_flight_limit
+	{
+	public:
+		in_flight_limit(std::size_t max_chunks, std::uint64_t max_bytes)
+			: m_max_chunks(std::max<std::size_t>(1, max_chunks)), m_max_bytes(max_bytes)
+		{}
+
+		in_flight_limit(const in_flight_limit&) = delete;
+		in_flight_limit& operator=(const in_flight_limit&) = delete;
+
+		// producer side, returns the wall seconds spent waiting
+		double acquire(std::uint64_t bytes)
+		{
+			constexpr int spin_count = 1 << 6;
+			double waited = 0;
+			if (!fits(bytes)) {
+				const auto wait_start = std::chrono::steady_clock::now();
+				for (int i = 0; i < spin_count && !fits(bytes); i++) {
+					std::this_thread::yield();
+				}
+				if (!fits(bytes)) {
+					std::unique_lock<std::mutex> ul(m_lock);
+					m_waiting.store(true, std::memory_order_relaxed);
+					// pairs with the fence of release: either we see the released chunk or it sees us waiting
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					m_cv.wait(ul, [&] { return fits(bytes); });
+					m_waiting.store(false, std::memory_order_relaxed);
+				}
+				waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+			}
+			m_chunks.fetch_add(1, std::memory_order_relaxed);
+			m_high_water = std::max(m_high_water, m_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+			return waited;
+		}
+
+		// worker side
+		void release(std::uint64_t bytes)
+		{
+			m_bytes.fetch_sub(bytes, std::memory_order_release);
+			m_chunks.fetch_sub(1, std::memory_order_release);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_waiting.load(std::memory_order_relaxed)) {
+				std::lock_guard<std::mutex> lg(m_lock);
+				m_cv.notify_one();
+			}
+		}
+
+		std::uint64_t high_water() const { return m_high_water; }
+
+	private:
+		bool fits(std::uint64_t bytes) const
+		{
+			const std::size_t chunks = m_chunks.load(std::memory_order_acquire);
+			return !chunks || (chunks < m_max_chunks && (!m_max_bytes || m_bytes.load(std::memory_order_acquire) + bytes <= m_max_bytes));
+		}
+
+		const std::size_t m_max_chunks;
+		const std::uint64_t m_max_bytes;
+		std::atomic<std::size_t> m_chunks{ 0 };
+		std::atomic<std::uint64_t> m_bytes{ 0 };
+		std::uint64_t m_high_water = 0; // only written by the producer
+
+		std::atomic<bool> m_waiting{ false };
+		std::mutex m_lock;
+		std::condition_variable m_cv;
+	};
+
+
+	// asynchronous readers used to deserialize chunk of data. Chunks are handed over through a lock-free ring,
+	// the lock only being taken to put an idle worker to sleep and to wake it up
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	class async_reader
+	{
+		using StoragePtr = std::shared_ptr< std::vector<DATA_TYPE>>;
+
+		// either lines cut by the producer, or a byte range of an input that the worker cuts itself
+		struct queued_chunk {
+			StoragePtr storage;
+			std::stringstream buffer;
+			std::string_view input;
+			std::size_t first = 0;
+			std::size_t last = 0;
+			std::uint64_t charged = 0; // bytes released from the in-flight limit once parsed
+			std::chrono::steady_clock::time_point enqueued; // only set when tracing
+		};
+	public:
+		async_reader(in_flight_limit& limit, std::size_t queue_capacity, worker_stats* stats = nullptr, bool trace = false)
+			: m_prototype(CUSTOM_PROTOTYPE()), m_arena(std::make_shared<string_arena>()),
+			m_queue(std::min(queue_capacity, chunk_queue_capacity)), m_limit(limit),
+			m_stats(stats_enabled ? stats : nullptr), m_trace(m_stats && trace)
+		{
+			m_prototype.bind_arena(m_arena.get());
+			m_worker = std::thread([&]() { run(); });
+		}
+
+		~async_reader() {
+			shut_down();
+			m_worker.join();
+		}
+
+		// hand a chunk of lines to the worker, false when its queue is full, the buffer being left untouched.
+		// the chunk is charged to the in-flight limit by the caller
+		bool try_enqueue(const StoragePtr& storage, std::stringstream& buffer, std::uint64_t charged) {
+			queued_chunk chunk;
+			chunk.storage = storage;
+			chunk.buffer = std::move(buffer);
+			chunk.charged = charged;
+			if (!try_push(chunk)) {
+				buffer = std::move(chunk.buffer);
+				return false;
+			}
+			return true;
+		}
+
+		// hand the lines starting within [first, last) of an input to the worker, false when its queue is full.
+		// the input has to outlive the reader
+		bool try_enqueue(const StoragePtr& storage, std::string_view input, std::size_t first, std::size_t last, std::uint64_t charged) {
+			queued_chunk chunk;
+			chunk.storage = storage;
+			chunk.input = input;
+			chunk.first = first;
+			chunk.last = last;
+			chunk.charged = charged;
+			return try_push(chunk);
+		}
+
+		void shut_down() {
+			m_running.store(false, std::memory_order_release);
+			std::lock_guard<std::mutex> lg(m_lock);
+			m_cv.notify_one();
+		}
+
+		// storage of the string_view cells deserialized by this reader
+		std::shared_ptr<string_arena> arena() const { return m_arena; }
+
+		// most chunks enqueued and not yet parsed, only counted when stats are recorded
+		std::size_t queue_high_water() const { return m_high_water; }
+
+	private:
+		bool try_push(queued_chunk& chunk) {
+			if (m_trace) {
+				chunk.enqueued = std::chrono::steady_clock::now();
+			}
+			if (!m_queue.try_push(chunk)) {
+				return false;
+			}
+			if (m_stats) {
+				m_high_water = std::max(m_high_water, m_queue.size());
+			}
+			// pairs with the fence of a worker going to sleep: either it sees the chunk or we see it sleeping
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_sleeping.load(std::memory_order_relaxed)) {
+				std::lock_guard<std::mutex> lg(m_lock);
+				m_cv.notify_one();
+			}
+			return true;
+		}
+
+		// while the thread exists, either parse chunks of data or sleep
+		void run() {
+			while (true)
+			{
+				queued_chunk* chunk = m_queue.front();
+				if (!chunk) {
+					if (!wait_for_chunk()) break;
+					continue;
+				}
+
+				try
+				{
+					stage_timer busy(m_stats ? &m_stats->busy : nullptr);
+					auto row = chunk->storage;
+					const std::size_t row_count = row->size();
+					const auto start = m_trace ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+					std::uint64_t bytes = 0;
+					if (chunk->input.data()) {
+						bytes = parse_range(*row, chunk->input, chunk->first, chunk->last);
+					}
+					else {
+						bytes = m_stats ? remaining_bytes(chunk->buffer) : 0;
+						while (std::getline(chunk->buffer, m_line))
+						{
+							row->push_back(m_prototype.deserialize(m_lines.reset(m_line)));
+						}
+					}
+					if (m_stats) {
+						m_stats->chunks++;
+						m_stats->bytes += bytes;
+						m_stats->rows += row->size() - row_count;
+						if (m_trace) {
+							m_stats->spans.push_back({ "chunk", start, std::chrono::steady_clock::now(), chunk->enqueued, bytes, row->size() - row_count });
+						}
+					}
+				}
+				catch (...)
+				{
+					thread_exception = std::current_exception();
+				}
+				const std::uint64_t charged = chunk->charged;
+				m_queue.pop();
+				m_limit.release(charged);
+			}
+		}
+
+		// lines belong to the range holding their first byte: the range is moved to the first line start at or after
+		// first, and its last line may end past last. Returns the bytes of the lines parsed
+		std::size_t parse_range(std::vector<DATA_TYPE>& rows, std::string_view input, std::size_t first, std::size_t last) {
+			const char* data = input.data();
+			const std::size_t size = input.size();
+			const auto find_line_end = [&](std::size_t position) {
+				const void* newline = std::memchr(data + position, '\n', size - position);
+				return newline ? static_cast<std::size_t>(static_cast<const char*>(newline) - data) : size;
+			};
+
+			std::size_t position = first;
+			if (position && data[position - 1] != '\n') {
+				position = std::min(find_line_end(position) + 1, size);
+			}
+			const std::size_t begin = position;
+			while (position < last && position < size)
+			{
+				const std::size_t end = find_line_end(position);
+				rows.push_back(m_prototype.deserialize(m_lines.reset(std::string_view(data + position, end - position))));
+				position = end + 1;
+			}
+			return std::min(position, size) - begin;
+		}
+
+		// spin for a while then sleep until a chunk is enqueued. false once shut down with nothing left to parse
+		bool wait_for_chunk() {
+			constexpr int spin_count = 1 << 6;
+			const auto wait_start = m_stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+
+			bool found = false;
+			for (int i = 0; i < spin_count && !found && m_running.load(std::memory_order_acquire); i++) {
+				std::this_thread::yield();
+				found = m_queue.front() != nullptr;
+			}
+			if (!found) {
+				std::unique_lock<std::mutex> ul(m_lock);
+				m_sleeping.store(true, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				m_cv.wait(ul, [&] { return m_queue.front() != nullptr || !m_running.load(std::memory_order_acquire); });
+				m_sleeping.store(false, std::memory_order_relaxed);
+				// chunks enqueued before the shut down are visible once it is
+				found = m_queue.front() != nullptr;
+			}
+
+			if (m_stats) {
+				m_stats->idle += std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+			}
+			return found;
+		}
+
+	private:
+		std::atomic<bool> m_running{ true };
+		std::atomic<bool> m_sleeping{ false };
+
+		std::thread m_worker;
+		std::mutex m_lock;
+		std::condition_variable m_cv;
+
+		CUSTOM_PROTOTYPE m_prototype;
+		std::shared_ptr<string_arena> m_arena;
+		std::string m_line;
+		line_stream m_lines;
+		spsc_ring<queued_chunk> m_queue;
+		in_flight_limit& m_limit;
+
+		worker_stats* m_stats;
+		const bool m_trace;
+		std::size_t m_high_water = 0; // only written by the enqueuing thread
+	};
+
+
+	// hand a chunk to the first reader with room in its queue, starting from the one after the previous chunk.
+	// the producer only waits when every queue is full
+	template <typename READER, typename... CHUNK>
+	static void dispatch_chunk
+	(
+		std::vector<std::unique_ptr<READER>>& pool,
+		std::size_t& reader_index,
+		CHUNK&&... chunk
+	) {
+		while (true) {
+			for (std::size_t i = 0; i < pool.size(); i++) {
+				const std::size_t index = (reader_index + i) % pool.size();
+				if (pool[index]->try_enqueue(chunk...)) {
+					reader_index = (index + 1) % pool.size();
+					return;
+				}
+			}
+			std::this_thread::yield();
+		}
+	}
+
+
+	// collect the stats of a pool of readers once they joined
+	static void finish_async_stats(read_stats* stats, const std::vector<std::size_t>& high_waters)
+	{
+		if (!stats) {
+			return;
+		}
+		for (const worker_stats& worker : stats->workers) {
+			stats->parse.cpu += worker.busy.cpu;
+		}
+		for (const std::size_t high_water : high_waters) {
+			stats->queue_high_water = std::max(stats->queue_high_water, high_water);
+		}
+		stats->estimated_allocations += 2 * stats->chunks; // shared row storages and their first reserve
+	}
+
+
+	// parse the lines of an input on the async_reader objects, the header being already read. The calling thread
+	// only hands out byte ranges of chunk_size, each worker finding the lines starting within its range by itself
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static void read_ranges_async
+	(
+		Document<DATA_TYPE>& document,
+		std::string_view input,
+		const read_options& options,
+		read_stats* stats
+	)
+	{
+		const read_options tuned = tune_read_options(options, input.size(), input.substr(0, 1 << 16));
+		const std::size_t chunk_size = tuned.chunk_size;
+		if (stats) {
+			stats->chunk_size = chunk_size;
+			stats->workers.resize(tuned.threads);
+		}
+		std::vector<std::size_t> high_waters;
+
+		// store data process by threads to retrieve it in the right order
+		// use of smart pointers to avoid storage reallocation problems
+		std::vector<std::shared_ptr<std::vector<DATA_TYPE>>> storages;
+		storages.reserve(input.size() / chunk_size + 1);
+		std::vector<std::shared_ptr<string_arena>> arenas;
+
+		in_flight_limit limit(tuned.max_in_flight_chunks, tuned.max_in_flight_bytes);
+
+		{ // Processing scope for threads
+			std::vector<std::unique_ptr<async_reader<DATA_TYPE, CUSTOM_PROTOTYPE>>> pool = {};
+			pool.reserve(tuned.threads);
+
+			for (int i = 0; i < tuned.threads; i++) {
+				pool.push_back(std::make_unique<async_reader<DATA_TYPE, CUSTOM_PROTOTYPE>>(limit, tuned.max_in_flight_chunks,
+					stats ? &stats->workers[i] : nullptr, stats && stats->trace));
+				arenas.push_back(pool.back()->arena());
+			}
+
+			// the parse spans from the first chunk to the join of the readers, its cpu time being the one of the workers
+			std::chrono::steady_clock::time_point parse_start = std::chrono::steady_clock::now();
+			stage_timer split(stats ? &stats->split : nullptr);
+			std::size_t reader_index = 0;
+
+			for (std::size_t first = 0; first < input.size(); first += chunk_size)
+			{
+				// We prepare a storage to store the thread's result
+				storages.push_back(std::make_shared<std::vector<DATA_TYPE>>());
+				storages.back()->reserve(1 << 8); //arbitrary default starting capacity
+
+				const std::size_t last = std::min(first + chunk_size, input.size());
+				const double waited = limit.acquire(last - first);
+				if (stats) {
+					stats->chunks++;
+					stats->backpressure += waited;
+				}
+				dispatch_chunk(pool, reader_index, storages.back(), input, first, last, last - first);
+			}
+			split.stop();
+			trace_phase(stats, "split", parse_start, input.size());
+
+			const auto join_start = std::chrono::steady_clock::now();
+			for (auto& reader : pool) {
+				high_waters.push_back(reader->queue_high_water());
+				reader.reset();
+			}
+			trace_phase(stats, "join", join_start);
+			if (stats) {
+				stats->parse.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count();
+				stats->in_flight_high_water = limit.high_water();
+			}
+		} // calls reader's destructor that wait for their worker to finish processing and to join.
+
+		CheckForThreadException();
+		finish_async_stats(stats, high_waters);
+
+
+		// transferring processed data to the content
+		const auto merge_start = std::chrono::steady_clock::now();
+		stage_timer merge(stats ? &stats->merge : nullptr);
+		for (const auto& rows : storages) {
+			document.rows.insert(document.rows.end(), rows->begin(), rows->end());
+		}
+		for (auto& arena : arenas) {
+			if (!arena->empty()) {
+				document.arenas.push_back(std::move(arena));
+			}
+		}
+		merge.stop();
+		trace_phase(stats, "merge", merge_start, 0, document.rows.size());
+	}
+
+
+	// read asynchronously from file using a prototype deserialize function and async_reader objects.
+	// the workers parse the buffer in place, except with a standard library splitting the content of string
+	// buffers before C++20, where it is copied first and the peak memory is then twice the input
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_async_from_buffer
+	(
+		std::stringstream& buffer,
+		read_stats* stats = nullptr,
+		const read_options& options = {}
+	)
+	{
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+			CUSTOM_PROTOTYPE proto;
+		thread_exception = nullptr;
+		stats = start_stats(stats);
+		stage_timer total(stats ? &stats->total : nullptr);
+		if (stats) stats->bytes = remaining_bytes(buffer);
+
+		auto document = std::make_unique<Document<DATA_TYPE>>();
+		read_header_from_buffer(buffer, document->header, proto.get_delimiter());
+
+		// the workers read the unread content in place from the get area when it holds all of it, otherwise
+		// from the view of the content in C++20 and from a copy before
+		const std::uint64_t remaining = remaining_bytes(buffer);
+		std::string_view input = get_area(buffer);
+		std::string content;
+		if (input.size() != remaining) {
+			const std::streamoff position = buffer.tellg();
+#if __cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)
+			input = buffer.view();
+#else
+			content = buffer.str();
+			input = content;
+#endif
+			input.remove_prefix(position < 0 ? input.size() : std::min(input.size(), static_cast<std::size_t>(position)));
+		}
+
+		read_ranges_async<DATA_TYPE, CUSTOM_PROTOTYPE>(*document, input, options, stats);
+		buffer.seekg(0, std::ios_base::end);
+
+		finish_stats(stats, *document);
+		return document;
+	}
+
+
+	// read asynchronously from a memory-mapped file, the workers parsing their ranges of lines in place
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_async_from_mapped_file
+	(
+		const std::string& path,
+		read_stats* stats = nullptr,
+		const read_options& options = {}
+	)
+	{
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+			CUSTOM_PROTOTYPE proto;
+		thread_exception = nullptr;
+		stats = start_stats(stats);
+		stage_timer total(stats ? &stats->total : nullptr);
+
+		const mapped_file file(path);
+		std::string_view input(file.data(), file.size());
+		if (stats) stats->bytes = input.size();
+
+		auto document = std::make_unique<Document<DATA_TYPE>>();
+		const std::size_t header_end = std::min(input.find('\n'), input.size());
+		std::stringstream header_line(std::string(input.substr(0, header_end)));
+		read_header_from_buffer(header_line, document->header, proto.get_delimiter());
+		input.remove_prefix(std::min(header_end + 1, input.size()));
+
+		read_ranges_async<DATA_TYPE, CUSTOM_PROTOTYPE>(*document, input, options, stats);
+
+		finish_stats(stats, *document);
+		return document;
+	}
+
+
+	// read asynchronously from a source of blocks: chunks are handed to the async_reader objects as soon as
+	// their block is read, so that reading the input overlaps with its parsing
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_async_from_source
+	(
+		block_source& source,
+		read_stats* stats = nullptr,
+		const read_options& options = {}
+	)
+	{
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+			CUSTOM_PROTOTYPE proto;
+		thread_exception = nullptr;
+		stats = start_stats(stats);
+		stage_timer total(stats ? &stats->total : nullptr);
+
+		// lines are only seen once the source is read, so chunks are sized from the input size alone
+		const read_options tuned = tune_read_options(options, source.size());
+		if (stats) {
+			stats->chunk_size = tuned.chunk_size;
+			stats->workers.resize(tuned.threads);
+		}
+		std::vector<std::size_t> high_waters;
+
+		auto document = std::make_unique<Document<DATA_TYPE>>();
+		std::vector<std::shared_ptr<std::vector<DATA_TYPE>>> storages;
+		storages.reserve(1 << 10); // arbitrary default starting capacity
+		std::vector<std::shared_ptr<string_arena>> arenas;
+
+		in_flight_limit limit(tuned.max_in_flight_chunks, tuned.max_in_flight_bytes);
+
+		{ // Processing scope for threads
+			std::vector<std::unique_ptr<async_reader<DATA_TYPE, CUSTOM_PROTOTYPE>>> pool = {};
+			pool.reserve(tuned.threads);
+
+			for (int i = 0; i < tuned.threads; i++) {
+				pool.push_back(std::make_unique<async_reader<DATA_TYPE, CUSTOM_PROTOTYPE>>(limit, tuned.max_in_flight_chunks,
+					stats ? &stats->workers[i] : nullptr, stats && stats->trace));
+				arenas.push_back(pool.back()->arena());
+			}
+
+			std::chrono::steady_clock::time_point parse_start = std::chrono::steady_clock::now();
+			std::size_t reader_index = 0;
+			split_source_into_chunks(source, document->header, proto.get_delimiter(), tuned.chunk_size,
+				[&](std::stringstream chunk) {
+					storages.push_back(std::make_shared<std::vector<DATA_TYPE>>());
+					storages.back()->reserve(1 << 8); //arbitrary default starting capacity
+
+					const std::uint64_t bytes = remaining_bytes(chunk);
+					const double waited = limit.acquire(bytes);
+					if (stats) {
+						stats->chunks++;
+						stats->backpressure += waited;
+					}
+					dispatch_chunk(pool, reader_index, storages.back(), chunk, bytes);
+				}, stats);
+			trace_phase(stats, "read and split", parse_start, stats ? stats->bytes : 0);
+
+			const auto join_start = std::chrono::steady_clock::now();
+			for (auto& reader : pool) {
+				high_waters.push_back(reader->queue_high_water());
+				reader.reset();
+			}
+			trace_phase(stats, "join", join_start);
+			if (stats) {
+				stats->parse.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count();
+				stats->in_flight_high_water = limit.high_water();
+			}
+		} // calls reader's destructor that wait for their worker to finish processing and to join.
+
+		CheckForThreadException();
+		finish_async_stats(stats, high_waters);
+
+		const auto merge_start = std::chrono::steady_clock::now();
+		stage_timer merge(stats ? &stats->merge : nullptr);
+		for (const auto& rows : storages) {
+			document->rows.insert(document->rows.end(), rows->begin(), rows->end());
+		}
+		for (auto& arena : arenas) {
+			if (!arena->empty()) {
+				document->arenas.push_back(std::move(arena));
+			}
+		}
+		merge.stop();
+		trace_phase(stats, "merge", merge_start, 0, document->rows.size());
+		finish_stats(stats, *document);
+		return document;
+	}
+
+
+	// time parallel reads of the first sample_size bytes of a file with candidate worker counts and chunk sizes,
+	// and return the fastest options. Meant to be run once and reused for inputs shaped like the sample
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static read_options calibrate_read_options
+	(
+		const std::string& path,
+		std::size_t sample_size = 1 << 24,
+		int repeat = 3
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			throw error::io_exception("Error while trying to open the specified path.");
+		}
+		std::string sample(sample_size, '\0');
+		file.read(sample.data(), static_cast<std::streamsize>(sample_size));
+		sample.resize(static_cast<std::size_t>(file.gcount()));
+		sample.resize(sample.rfind('\n') + 1); // npos + 1 empties samples without a complete line
+
+		std::vector<int> thread_candidates;
+		const int hardware = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+		for (int threads = 1; threads < hardware; threads *= 2) {
+			thread_candidates.push_back(threads);
+		}
+		thread_candidates.push_back(hardware);
+
+		const read_options tuned = tune_read_options({}, sample.size(), sample);
+		read_options best = tuned;
+		double best_seconds = std::numeric_limits<double>::max();
+		for (const int threads : thread_candidates) {
+			for (const std::size_t chunk_size : { tuned.chunk_size / 4, tuned.chunk_size, tuned.chunk_size * 4 }) {
+				// candidates leaving workers without chunks to balance are skipped
+				if (chunk_size < 1 << 12 || (threads > 1 && sample.size() / chunk_size < static_cast<std::size_t>(threads) * 2)) {
+					continue;
+				}
+				const read_options candidate = { chunk_size, threads };
+				std::vector<double> durations;
+				for (int i = 0; i < std::max(1, repeat); i++) {
+					std::stringstream buffer(sample);
+					const auto start = std::chrono::steady_clock::now();
+					read_async_from_buffer<DATA_TYPE, CUSTOM_PROTOTYPE>(buffer, nullptr, candidate);
+					durations.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+				}
+				std::sort(durations.begin(), durations.end());
+				if (durations[durations.size() / 2] < best_seconds) {
+					best_seconds = durations[durations.size() / 2];
+					best = candidate;
+				}
+			}
+		}
+		return best;
+	}
+#endif
+
+
+
+	// read from file with a default asynchronous behavior
+#ifndef NO_ASYNC
+
+	// STREAM reads the file block by block ahead of the parsing workers instead of loading it first,
+	// MAPPED hands a memory-mapped file to the parsing workers without copying it into a buffer,
+	// AUTO picks one of them for each file, see choose_method
+	enum class Method {
+		DEFAULT,
+		ASYNC,
+		STREAM,
+		MAPPED,
+		AUTO,
+	};
+
+	static const char* method_name(Method method)
+	{
+		switch (method)
+		{
+		case Method::DEFAULT: return "DEFAULT";
+		case Method::ASYNC: return "ASYNC";
+		case Method::STREAM: return "STREAM";
+		case Method::MAPPED: return "MAPPED";
+		case Method::AUTO: return "AUTO";
+		}
+		return "";
+	}
+
+	// memory the process can use without swapping, 0 when unknown
+	static std::uint64_t available_memory()
+	{
+#ifdef __linux__
+		std::ifstream meminfo("/proc/meminfo");
+		std::string key;
+		std::uint64_t value = 0;
+		while (meminfo >> key >> value) {
+			if (key == "MemAvailable:") {
+				return value << 10;
+			}
+			meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		}
+#endif
+#if defined(CSV_POSIX) && defined(_SC_AVPHYS_PAGES)
+		const long pages = ::sysconf(_SC_AVPHYS_PAGES);
+		const long page_size = ::sysconf(_SC_PAGESIZE);
+		if (pages > 0 && page_size > 0) {
+			return static_cast<std::uint64_t>(pages) * static_cast<std::uint64_t>(page_size);
+		}
+#endif
+		return 0;
+	}
+
+	// sequential parsing when it would take less than the startup of the workers or when there is a single core,
+	// streaming when loading the input would take a large share of the available memory, otherwise parallel
+	// parsing over the mapped file, which spares the copy of the file into a buffer
+	static Method choose_method(std::uint64_t size, double estimated_parse, std::uint64_t available_memory, unsigned cores)
+	{
+		constexpr double parallel_threshold = 2e-3; // seconds
+		if (cores <= 1 || estimated_parse < parallel_threshold) {
+			return Method::DEFAULT;
+		}
+		if (available_memory && size > available_memory / 4) {
+			return Method::STREAM;
+		}
+#ifdef CSV_POSIX
+		return Method::MAPPED;
+#else
+		return Method::ASYNC;
+#endif
+	}
+
+	// seconds per byte of the sequential parse of the first lines of a file, 0 for files shorter than the sample,
+	// their whole parse being cheaper than anything measured on them. The sample is extended until it holds the
+	// header and a complete row; when even max_sample_size bytes do not, a typical parse speed is assumed instead
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static double measure_parse_cost(const std::string& path, std::uint64_t size, std::size_t sample_size = 1 << 16)
+	{
+		constexpr std::size_t max_sample_size = 1 << 24;
+		constexpr double unsampled_parse_cost = 1e-8; // seconds per byte, about 100MB/s
+		if (size <= sample_size) {
+			return 0;
+		}
+		std::ifstream file(path, std::ios::binary);
+		std::string sample;
+		const auto has_row = [&] {
+			const std::size_t header_end = sample.find('\n');
+			return header_end != std::string::npos && sample.find('\n', header_end + 1) != std::string::npos;
+		};
+		while (!has_row() && sample.size() < max_sample_size && file) {
+			const std::size_t sampled = sample.size();
+			sample.resize(sampled + sample_size);
+			file.read(sample.data() + sampled, static_cast<std::streamsize>(sample_size));
+			sample.resize(sampled + static_cast<std::size_t>(file.gcount()));
+		}
+		if (!has_row()) {
+			return unsampled_parse_cost;
+		}
+		sample.resize(sample.rfind('\n') + 1);
+		std::stringstream buffer(sample);
+		const auto start = std::chrono::steady_clock::now();
+		read_from_buffer<DATA_TYPE, CUSTOM_PROTOTYPE>(buffer);
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / sample.size();
+	}
+
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_from_file
+	(
+		const std::string& path,
+		Method method = Method::AUTO,
+		read_stats* stats = nullptr,
+		const read_options& options = {}
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+		const Compression compression = detect_compression(path);
+		if (method == Method::AUTO) {
+			std::error_code ec;
+			const std::uint64_t size = std::filesystem::file_size(path, ec);
+			if (ec) {
+				throw error::io_exception("Error while trying to open the specified path.");
+			}
+			const double estimated_parse = compression == Compression::NONE ? measure_parse_cost<DATA_TYPE, CUSTOM_PROTOTYPE>(path, size) * size : 0;
+			const std::uint64_t memory = available_memory();
+			const unsigned cores = options.threads > 0 ? static_cast<unsigned>(options.threads) : std::thread::hardware_concurrency();
+			// compressed files are streamed whatever is picked, only the parallelism is chosen for them
+			const Method chosen = compression == Compression::NONE ? choose_method(size, estimated_parse, memory, cores)
+				: (cores > 1 ? Method::STREAM : Method::DEFAULT);
+
+			auto document = read_from_file<DATA_TYPE, CUSTOM_PROTOTYPE>(path, chosen, stats, options);
+			if (stats_enabled && stats) {
+				stats->strategy = method_name(chosen);
+				stats->estimated_parse = estimated_parse;
+				stats->available_memory = memory;
+				stats->cores = cores;
+			}
+			return document;
+		}
+		if (method == Method::MAPPED && compression == Compression::NONE) {
+			return read_async_from_mapped_file<DATA_TYPE, CUSTOM_PROTOTYPE>(path, stats, options);
+		}
+		// compressed files are always streamed, decompression overlapping with parsing
+		if (method == Method::STREAM || compression != Compression::NONE) {
+			auto source = open_input_source(path);
+			if (method == Method::DEFAULT) {
+				return read_from_source<DATA_TYPE, CUSTOM_PROTOTYPE>(*source, stats);
+			}
+			return read_async_from_source<DATA_TYPE, CUSTOM_PROTOTYPE>(*source, stats, options);
+		}
+		stage_time load;
+		std::stringstream buffer = load_buffer_from_file(path, stats ? &load : nullptr);
+
+		std::unique_ptr<Document<DATA_TYPE>> document;
+		switch (method)
+		{
+		case csv::Method::DEFAULT:
+			document = read_from_buffer<DATA_TYPE, CUSTOM_PROTOTYPE>(buffer, stats);
+			break;
+		case csv::Method::ASYNC:
+			document = read_async_from_buffer<DATA_TYPE, CUSTOM_PROTOTYPE>(buffer, stats, options);
+			break;
+		default:
+			throw error::not_implemented("Reading method not implemented.");
+		}
+		add_load_stats(stats, load);
+		return document;
+	}
+#else
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_from_file
+	(
+		const std::string& path,
+		read_stats* stats = nullptr
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+		if (detect_compression(path) != Compression::NONE) {
+			auto source = open_input_source(path);
+			return read_from_source<DATA_TYPE, CUSTOM_PROTOTYPE>(*source, stats);
+		}
+		stage_time load;
+		std::stringstream buffer = load_buffer_from_file(path, stats ? &load : nullptr);
+		auto document = read_from_buffer<DATA_TYPE, CUSTOM_PROTOTYPE>(buffer, stats);
+		add_load_stats(stats, load);
+		return document;
+	}
+#endif
+
+
+	// read from inputs that cannot be mapped or seeked, like stdin and pipes: blocks are parsed as they arrive.
+	// gzip and zstd streams are decompressed on the fly
+#ifndef NO_ASYNC
+#ifdef CSV_POSIX
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_from_fd
+	(
+		int fd,
+		Method method = Method::ASYNC,
+		read_stats* stats = nullptr,
+		const read_options& options = {}
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+		auto source = open_fd_source(fd);
+		if (method == Method::DEFAULT) {
+			return read_from_source<DATA_TYPE, CUSTOM_PROTOTYPE>(*source, stats);
+		}
+		return read_async_from_source<DATA_TYPE, CUSTOM_PROTOTYPE>(*source, stats, options);
+	}
+#endif
+
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_from_stream
+	(
+		std::istream& stream,
+		Method method = Method::ASYNC,
+		read_stats* stats = nullptr,
+		const read_options& options = {}
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+		auto source = open_stream_source(stream);
+		if (method == Method::DEFAULT) {
+			return read_from_source<DATA_TYPE, CUSTOM_PROTOTYPE>(*source, stats);
+		}
+		return read_async_from_source<DATA_TYPE, CUSTOM_PROTOTYPE>(*source, stats, options);
+	}
+#else
+#ifdef CSV_POSIX
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_from_fd
+	(
+		int fd,
+		read_stats* stats = nullptr
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+		auto source = open_fd_source(fd);
+		return read_from_source<DATA_TYPE, CUSTOM_PROTOTYPE>(*source, stats);
+	}
+#endif
+
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_from_stream
+	(
+		std::istream& stream,
+		read_stats* stats = nullptr
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+		auto source = open_stream_source(stream);
+		return read_from_source<DATA_TYPE, CUSTOM_PROTOTYPE>(*source, stats);
+	}
+#endif
+
+
+
+	// -----------------------------------
+	// [ SECTION ] Incremental reading
+	// -----------------------------------
+
+
+	// follow a growing csv file (e.g. a log) and append the new rows to an existing document on each poll.
+	// the reader remembers the committed byte offset and the trailing partial line between polls,
+	// and starts over from the beginning of the file when it detects a truncation or a rotation.
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	class tail_reader
+	{
+		static constexpr std::size_t block_size = 1 << 16;
+	public:
+		tail_reader(std::string path)
+			: m_path(std::move(path))
+		{
+			CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+			m_prototype.bind_arena(m_arena.get());
+		}
+
+		~tail_reader() {
+			close_file();
+#ifdef __linux__
+			if (m_notify_fd >= 0) ::close(m_notify_fd);
+#endif
+		}
+
+		tail_reader(const tail_reader&) = delete;
+		tail_reader& operator=(const tail_reader&) = delete;
+
+		// parse the bytes appended since the last poll, returns the number of rows pushed into the document.
+		// the header is read from the first line of the file when the document does not have one yet.
+		std::size_t poll(Document<DATA_TYPE>& document)
+		{
+			// string_view cells of every poll are stored in the arena of the reader, attached to the document once
+			const bool attached = std::find(document.arenas.begin(), document.arenas.end(), m_arena) != document.arenas.end();
+			if (!attached) {
+				document.arenas.push_back(m_arena);
+			}
+
+			const std::size_t rows_num = read_appended(document);
+			if (!attached && m_arena->empty()) {
+				document.arenas.pop_back();
+			}
+			return rows_num;
+		}
+
+		// block until the file is modified, created or moved, or until the timeout expires.
+		// returns false on timeout. Relies on inotify on linux and simply sleeps elsewhere.
+		bool wait(std::chrono::milliseconds timeout)
+		{
+#ifdef __linux__
+			if (m_notify_fd < 0) {
+				m_notify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+				// watch the parent directory so that rotations (file moved or recreated) are reported too
+				const std::size_t slash = m_path.find_last_of('/');
+				const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : m_path.substr(0, slash);
+				if (m_notify_fd < 0 || ::inotify_add_watch(m_notify_fd, directory.c_str(),
+					IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CLOSE_WRITE) < 0) {
+					throw error::io_exception("Error while trying to watch the specified path.");
+				}
+			}
+
+			const std::string name = m_path.substr(m_path.find_last_of('/') + 1);
+			const auto deadline = std::chrono::steady_clock::now() + timeout;
+			alignas(inotify_event) char events[4096];
+			while (true)
+			{
+				const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+				pollfd pfd = { m_notify_fd, POLLIN, 0 };
+				if (remaining.count() <= 0 || ::poll(&pfd, 1, static_cast<int>(remaining.count())) <= 0) {
+					return false;
+				}
+
+				const ssize_t length = ::read(m_notify_fd, events, sizeof(events));
+				for (ssize_t i = 0; i < length; ) {
+					const inotify_event* event = reinterpret_cast<const inotify_event*>(events + i);
+					if (event->len && name == event->name) {
+						return true;
+					}
+					i += sizeof(inotify_event) + event->len;
+				}
+			}
+#else
+			std::this_thread::sleep_for(timeout);
+			return true;
+#endif
+		}
+
+		// offset of the first byte that has not been turned into a row yet
+		std::uint64_t committed_offset() const { return m_offset - m_partial.size(); }
+
+		// bytes read after the last complete line, waiting for the rest of the line
+		const std::string& partial_line() const { return m_partial; }
+
+	private:
+		std::size_t read_appended(Document<DATA_TYPE>& document)
+		{
+			std::size_t rows_num = document.rows.size();
+#ifdef CSV_POSIX
+			if (m_fd < 0 && !open_file()) {
+				return 0; // the file does not exist (yet), e.g. in the middle of a rotation
+			}
+
+			struct stat path_stat;
+			const bool rotated = ::stat(m_path.c_str(), &path_stat) == 0
+				&& (path_stat.st_ino != m_inode || path_stat.st_dev != m_device);
+
+			// drain what was appended to the old file before switching to the new one
+			read_available(document);
+
+			if (rotated) {
+				close_file();
+				restart();
+				if (open_file()) {
+					read_available(document);
+				}
+			}
+#else
+			std::error_code ec;
+			const std::uintmax_t size = std::filesystem::file_size(m_path, ec);
+			if (ec) {
+				return 0;
+			}
+			if (size < m_offset) {
+				restart();
+			}
+
+			std::ifstream file(m_path, std::ios::binary);
+			if (!file.is_open()) {
+				return 0;
+			}
+			file.seekg(static_cast<std::streamoff>(m_offset));
+			char block[block_size];
+			while (file.read(block, block_size) || file.gcount()) {
+				consume(document, block, static_cast<std::size_t>(file.gcount()));
+			}
+#endif
+			return document.rows.size() - rows_num;
+		}
+
+		// parse raw bytes: complete lines are deserialized, the incomplete trailing line is kept for the next poll.
+		// lines are committed one at a time before being deserialized, so a line that fails to deserialize is
+		// the only one lost and the next poll resumes right after it
+		void consume(Document<DATA_TYPE>& document, const char* data, std::size_t size)
+		{
+			const char* end = data + size;
+			const char* newline;
+			while ((newline = static_cast<const char*>(std::memchr(data, '\n', end - data))))
+			{
+				m_partial.append(data, newline);
+				m_offset += newline + 1 - data;
+				data = newline + 1;
+				m_line.swap(m_partial);
+				m_partial.clear();
+
+				if (m_header_pending) {
+					m_header_pending = false;
+					if (document.header.empty()) {
+						std::stringstream stream(m_line);
+						read_header_from_buffer(stream, document.header, m_prototype.get_delimiter());
+					}
+				}
+				else {
+					document.rows.push_back(m_prototype.deserialize(m_lines.reset(m_line)));
+				}
+			}
+			m_partial.append(data, end);
+			m_offset += end - data;
+		}
+
+		void restart() {
+			m_offset = 0;
+			m_partial.clear();
+			m_header_pending = true;
+		}
+
+#ifdef CSV_POSIX
+		bool open_file()
+		{
+			m_fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (m_fd < 0) {
+				return false;
+			}
+			struct stat file_stat;
+			::fstat(m_fd, &file_stat);
+			m_inode = file_stat.st_ino;
+			m_device = file_stat.st_dev;
+			return true;
+		}
+
+		void close_file() {
+			if (m_fd >= 0) ::close(m_fd);
+			m_fd = -1;
+		}
+
+		void read_available(Document<DATA_TYPE>& document)
+		{
+			struct stat file_stat;
+			if (::fstat(m_fd, &file_stat) != 0) {
+				throw error::io_exception("Error while trying to read the specified path.");
+			}
+			if (static_cast<std::uint64_t>(file_stat.st_size) < m_offset) {
+				restart(); // truncated, e.g. copytruncate rotation
+			}
+
+			char block[block_size];
+			ssize_t length;
+			while ((length = ::pread(m_fd, block, block_size, static_cast<off_t>(m_offset))) > 0) {
+				consume(document, block, static_cast<std::size_t>(length));
+			}
+			if (length < 0) {
+				throw error::io_exception("Error while trying to read the specified path.");
+			}
+		}
+#else
+		void close_file() {}
+#endif
+
+	private:
+		const std::string m_path;
+		CUSTOM_PROTOTYPE m_prototype;
+		std::shared_ptr<string_arena> m_arena = std::make_shared<string_arena>();
+
+		std::uint64_t m_offset = 0;
+		std::string m_partial;
+		std::string m_line;
+		line_stream m_lines;
+		bool m_header_pending = true;
+
+#ifdef CSV_POSIX
+		int m_fd = -1;
+		ino_t m_inode = 0;
+		dev_t m_device = 0;
+#endif
+#ifdef __linux__
+		int m_notify_fd = -1;
+#endif
+	};
+
+
+
+	// ---------------------------
+	// [ SECTION ] Binary cache
+	// ---------------------------
+
+
+	// parsed documents can be stored in a versioned binary file next to their source and memory-mapped on the
+	// next read instead of being parsed again, as long as the size, modification time and hash of the source match.
+	// supported rows are std::vector of arithmetic types or std::string (stored as typed columns, strings in a
+	// single arena), and trivially copyable user-defined types (stored as fixed-width rows).
+	namespace cache
+	{
+		constexpr char magic[8] = { 'C', 'S', 'V', 'C', 'A', 'C', 'H', 'E' };
+		constexpr std::uint32_t version = 1;
+		constexpr std::uint64_t alignment = 64;
+
+		enum class Layout : std::uint32_t {
+			FIXED_COLUMNS = 1,
+			STRING_COLUMNS = 2,
+			RAW_ROWS = 3,
+		};
+
+		struct source_identity {
+			std::uint64_t size = 0;
+			std::int64_t mtime = 0;
+			std::uint64_t hash = 0;
+		};
+
+		struct file_header {
+			char magic[8];
+			std::uint32_t version;
+			Layout layout;
+			source_identity source;
+			std::uint64_t value_size;
+			std::uint64_t value_kind;
+			std::uint64_t rows;
+			std::uint64_t columns;
+			std::uint64_t names_size;
+		};
+
+		// path of the cache file associated to a csv file
+		static std::string path_for(const std::string& source_path) {
+			return source_path + ".cache";
+		}
+
+		// 64-bit hash over 8-byte words, fast enough to stay far below the cost of parsing the source
+		static std::uint64_t hash_bytes(const char* data, std::size_t size)
+		{
+			constexpr std::uint64_t prime = 0x9E3779B97F4A7C15ull;
+			std::uint64_t hash = size * prime;
+			std::size_t i = 0;
+			for (; i + 8 <= size; i += 8) {
+				std::uint64_t word;
+				std::memcpy(&word, data + i, 8);
+				hash = (hash ^ word) * prime;
+				hash ^= hash >> 32;
+			}
+			std::uint64_t tail = 0;
+			std::memcpy(&tail, data + i, size - i);
+			hash = (hash ^ tail) * prime;
+			return hash ^ (hash >> 29);
+		}
+
+		static source_identity identify(const std::string& source_path)
+		{
+			source_identity identity;
+			std::error_code ec;
+			const auto mtime = std::filesystem::last_write_time(source_path, ec);
+			if (ec) {
+				throw error::io_exception("Error while trying to open the specified path.");
+			}
+			identity.mtime = static_cast<std::int64_t>(mtime.time_since_epoch().count());
+
+			mapped_file source(source_path);
+			identity.size = source.size();
+			identity.hash = hash_bytes(source.data(), source.size());
+			return identity;
+		}
+
+		template <typename T> struct is_vector : std::false_type {};
+		template <typename T> struct is_vector<std::vector<T>> : std::true_type {};
+
+		// user-defined rows are cached as their raw bytes, which is only valid for types without pointers,
+		// references or views (e.g. std::string_view cells pointing into an arena). Types opt in with
+		// template <> struct csv::cache::raw_rows<T> : std::true_type {};
+		template <typename T> struct raw_rows : std::false_type {};
+
+		template <typename DATA_TYPE>
+		static constexpr Layout layout_of()
+		{
+			if constexpr (is_vector<DATA_TYPE>::value) {
+				using value_type = typename DATA_TYPE::value_type;
+				static_assert((std::is_arithmetic_v<value_type> && !std::is_same_v<value_type, bool>) || std::is_same_v<value_type, std::string>,
+					"Cached rows should be vectors of arithmetic types other than bool, or strings.");
+				return std::is_same_v<value_type, std::string> ? Layout::STRING_COLUMNS : Layout::FIXED_COLUMNS;
+			}
+			else {
+				static_assert(raw_rows<DATA_TYPE>::value, "Cached user-defined types should opt in with csv::cache::raw_rows.");
+				static_assert(std::is_trivially_copyable_v<DATA_TYPE>, "Cached user-defined types should be trivially copyable.");
+				return Layout::RAW_ROWS;
+			}
+		}
+
+		template <typename DATA_TYPE>
+		static constexpr std::uint64_t value_size_of()
+		{
+			if constexpr (layout_of<DATA_TYPE>() == Layout::FIXED_COLUMNS) return sizeof(typename DATA_TYPE::value_type);
+			else if constexpr (layout_of<DATA_TYPE>() == Layout::RAW_ROWS) return sizeof(DATA_TYPE);
+			else return 0;
+		}
+
+		// distinguishes values of the same size, e.g. int and float columns
+		template <typename DATA_TYPE>
+		static constexpr std::uint64_t value_kind_of()
+		{
+			if constexpr (layout_of<DATA_TYPE>() == Layout::FIXED_COLUMNS) {
+				using value_type = typename DATA_TYPE::value_type;
+				return std::is_floating_point_v<value_type> ? 2 : std::is_signed_v<value_type> ? 1 : 0;
+			}
+			else if constexpr (layout_of<DATA_TYPE>() == Layout::RAW_ROWS) return alignof(DATA_TYPE);
+			else return 0;
+		}
+
+		static std::uint64_t align(std::uint64_t offset) {
+			return (offset + alignment - 1) / alignment * alignment;
+		}
+
+
+		// columnar view over a memory-mapped cache file, cells are read in place without copies
+		class view
+		{
+		public:
+			view(const std::string& cache_path)
+				: m_file(cache_path)
+			{
+				if (m_file.size() < sizeof(file_header)) {
+					return;
+				}
+				std::memcpy(&m_header, m_file.data(), sizeof(file_header));
+				if (std::memcmp(m_header.magic, magic, sizeof(magic)) || m_header.version != version) {
+					return;
+				}
+
+				// column names are stored as newline terminated strings
+				std::uint64_t offset = sizeof(file_header);
+				if (offset + m_header.names_size > m_file.size()) {
+					return;
+				}
+				const char* names = m_file.data() + offset;
+				for (const char* end = names + m_header.names_size; names < end; ) {
+					const char* newline = static_cast<const char*>(std::memchr(names, '\n', end - names));
+					if (!newline) return;
+					m_names.emplace_back(names, newline);
+					names = newline + 1;
+				}
+				offset = align(offset + m_header.names_size);
+
+				const std::uint64_t cells = m_header.rows * m_header.columns;
+				switch (m_header.layout)
+				{
+				case Layout::FIXED_COLUMNS:
+					m_columns_offset = offset;
+					m_columns_stride = align(m_header.rows * m_header.value_size);
+					m_end = offset + m_columns_stride * m_header.columns;
+					break;
+				case Layout::STRING_COLUMNS:
+					m_columns_offset = offset;
+					m_arena_offset = align(offset + (cells + 1) * sizeof(std::uint64_t));
+					m_end = m_arena_offset;
+					if (m_end <= m_file.size()) {
+						m_end += string_offsets()[cells];
+					}
+					break;
+				case Layout::RAW_ROWS:
+					m_columns_offset = offset;
+					m_end = offset + m_header.rows * m_header.value_size;
+					break;
+				default:
+					return;
+				}
+				m_valid = m_end <= m_file.size();
+			}
+
+			// true if the cache is well-formed and has been built from this exact source with the expected layout
+			bool valid_for(const source_identity& source, Layout layout, std::uint64_t value_size, std::uint64_t value_kind) const {
+				return m_valid && m_header.layout == layout && m_header.value_size == value_size && m_header.value_kind == value_kind
+					&& m_header.source.size == source.size && m_header.source.mtime == source.mtime && m_header.source.hash == source.hash;
+			}
+
+			const std::vector<std::string>& header() const { return m_names; }
+			std::uint64_t rows() const { return m_header.rows; }
+			std::uint64_t columns() const { return m_header.columns; }
+
+			// contiguous values of a column when rows are vectors of arithmetic types
+			template <typename T>
+			const T* column(std::size_t index) const {
+				return reinterpret_cast<const T*>(m_file.data() + m_columns_offset + m_columns_stride * index);
+			}
+
+			// string cell when rows are vectors of strings
+			std::string_view cell(std::size_t column, std::size_t row) const {
+				const std::uint64_t* offsets = string_offsets() + column * m_header.rows + row;
+				return std::string_view(m_file.data() + m_arena_offset + offsets[0], offsets[1] - offsets[0]);
+			}
+
+			// fixed-width rows when rows are trivially copyable user-defined types
+			template <typename DATA_TYPE>
+			const DATA_TYPE* raw_rows() const {
+				return reinterpret_cast<const DATA_TYPE*>(m_file.data() + m_columns_offset);
+			}
+
+		private:
+			const std::uint64_t* string_offsets() const {
+				return reinterpret_cast<const std::uint64_t*>(m_file.data() + m_columns_offset);
+			}
+
+		private:
+			mapped_file m_file;
+			file_header m_header = {};
+			std::vector<std::string> m_names;
+			bool m_valid = false;
+
+			std::uint64_t m_columns_offset = 0;
+			std::uint64_t m_columns_stride = 0;
+			std::uint64_t m_arena_offset = 0;
+			std::uint64_t m_end = 0;
+		};
+
+
+		// open the cache of a csv file whose identity is already known, returns nullptr if it does not exist or is out of date
+		template <typename DATA_TYPE>
+		static std::unique_ptr<view> open(const source_identity& source, const std::string& source_path, const std::string& cache_path = "")
+		{
+			const std::string path = cache_path.empty() ? path_for(source_path) : cache_path;
+			std::error_code ec;
+			if (!std::filesystem::exists(path, ec)) {
+				return nullptr;
+			}
+			auto cached = std::make_unique<view>(path);
+			if (!cached->valid_for(source, layout_of<DATA_TYPE>(), value_size_of<DATA_TYPE>(), value_kind_of<DATA_TYPE>())) {
+				return nullptr;
+			}
+			return cached;
+		}
+
+		// open the cache of a csv file, returns nullptr if it does not exist or is out of date
+		template <typename DATA_TYPE>
+		static std::unique_ptr<view> open(const std::string& source_path, const std::string& cache_path = "")
+		{
+			const std::string path = cache_path.empty() ? path_for(source_path) : cache_path;
+			std::error_code ec;
+			if (!std::filesystem::exists(path, ec)) {
+				return nullptr;
+			}
+			return open<DATA_TYPE>(identify(source_path), source_path, cache_path);
+		}
+
+
+		// store a document parsed from source_path into its cache file, stamped with the identity the source had
+		// before it was parsed: a source modified during the parse then leaves a cache that is already out of date.
+		// returns false when the rows cannot be laid out in columns (rows of different lengths).
+		template <typename DATA_TYPE>
+		static bool write(const source_identity& source, const std::string& source_path, const Document<DATA_TYPE>& document, const std::string& cache_path = "")
+		{
+			constexpr Layout layout = layout_of<DATA_TYPE>();
+
+			file_header header = {};
+			std::memcpy(header.magic, magic, sizeof(magic));
+			header.version = version;
+			header.layout = layout;
+			header.source = source;
+			header.value_size = value_size_of<DATA_TYPE>();
+			header.value_kind = value_kind_of<DATA_TYPE>();
+			header.rows = document.rows.size();
+			header.columns = 1;
+
+			if constexpr (layout != Layout::RAW_ROWS) {
+				header.columns = document.header.size() ? document.header.size() : document.rows.size() ? document.rows.front().size() : 0;
+				for (const auto& row : document.rows) {
+					if (row.size() != header.columns) {
+						return false;
+					}
+				}
+			}
+
+			std::string names;
+			for (const std::string& name : document.header) {
+				names.append(name).push_back('\n');
+			}
+			header.names_size = names.size();
+
+			// write next to the final file then rename it, so that concurrent readers never see a partial cache
+			const std::string path = cache_path.empty() ? path_for(source_path) : cache_path;
+			const std::string temporary_path = temporary_path_for(path);
+			{
+				std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+				if (!file.is_open()) {
+					throw error::io_exception("Error while trying to open the specified path.");
+				}
+
+				std::uint64_t offset = 0;
+				auto put = [&](const void* data, std::uint64_t size) {
+					file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+					offset += size;
+				};
+				auto pad = [&]() {
+					static const char zeros[alignment] = {};
+					put(zeros, align(offset) - offset);
+				};
+
+				put(&header, sizeof(header));
+				put(names.data(), names.size());
+				pad();
+
+				if constexpr (layout == Layout::FIXED_COLUMNS) {
+					std::vector<typename DATA_TYPE::value_type> column(document.rows.size());
+					for (std::uint64_t c = 0; c < header.columns; c++) {
+						for (std::size_t r = 0; r < document.rows.size(); r++) {
+							column[r] = document.rows[r][c];
+						}
+						put(column.data(), column.size() * sizeof(column[0]));
+						pad();
+					}
+				}
+				else if constexpr (layout == Layout::STRING_COLUMNS) {
+					std::vector<std::uint64_t> offsets;
+					offsets.reserve(header.rows * header.columns + 1);
+					offsets.push_back(0);
+					for (std::uint64_t c = 0; c < header.columns; c++) {
+						for (const auto& row : document.rows) {
+							offsets.push_back(offsets.back() + row[c].size());
+						}
+					}
+					put(offsets.data(), offsets.size() * sizeof(std::uint64_t));
+					pad();
+					for (std::uint64_t c = 0; c < header.columns; c++) {
+						for (const auto& row : document.rows) {
+							put(row[c].data(), row[c].size());
+						}
+					}
+				}
+				else {
+					put(document.rows.data(), document.rows.size() * sizeof(DATA_TYPE));
+				}
+
+				if (!file.good()) {
+					throw error::io_exception("Error while trying to write into the specified path.");
+				}
+			}
+
+			std::error_code ec;
+			std::filesystem::rename(temporary_path, path, ec);
+			if (ec) {
+				std::filesystem::remove(temporary_path, ec);
+				throw error::io_exception("Error while trying to write into the specified path.");
+			}
+			return true;
+		}
+
+		// store a document into the cache of a source that has not changed since it was parsed
+		template <typename DATA_TYPE>
+		static bool write(const std::string& source_path, const Document<DATA_TYPE>& document, const std::string& cache_path = "")
+		{
+			return write(identify(source_path), source_path, document, cache_path);
+		}
+
+
+		// rebuild a document from a cache opened with open()
+		template <typename DATA_TYPE>
+		static std::unique_ptr<Document<DATA_TYPE>> load(const view& cached)
+		{
+			auto document = std::make_unique<Document<DATA_TYPE>>();
+			document->header = cached.header();
+			const std::size_t rows = static_cast<std::size_t>(cached.rows());
+			const std::size_t columns = static_cast<std::size_t>(cached.columns());
+
+			constexpr Layout layout = layout_of<DATA_TYPE>();
+			if constexpr (layout == Layout::RAW_ROWS) {
+				const DATA_TYPE* data = cached.template raw_rows<DATA_TYPE>();
+				document->rows.assign(data, data + rows);
+			}
+			else {
+				document->rows.resize(rows);
+				for (auto& row : document->rows) {
+					row.reserve(columns);
+				}
+				for (std::size_t c = 0; c < columns; c++) {
+					if constexpr (layout == Layout::FIXED_COLUMNS) {
+						const auto* column = cached.template column<typename DATA_TYPE::value_type>(c);
+						for (std::size_t r = 0; r < rows; r++) {
+							document->rows[r].push_back(column[r]);
+						}
+					}
+					else {
+						for (std::size_t r = 0; r < rows; r++) {
+							document->rows[r].emplace_back(cached.cell(c, r));
+						}
+					}
+				}
+			}
+			return document;
+		}
+
+		// rebuild a document from the cache of a csv file, returns nullptr if the cache is missing or out of date
+		template <typename DATA_TYPE>
+		static std::unique_ptr<Document<DATA_TYPE>> read(const std::string& source_path, const std::string& cache_path = "")
+		{
+			auto cached = open<DATA_TYPE>(source_path, cache_path);
+			return cached ? load<DATA_TYPE>(*cached) : nullptr;
+		}
+	}
+
+
+	// read from the binary cache of the file when it is up to date, otherwise parse the file and refresh its cache
+	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
+	static std::unique_ptr<Document<DATA_TYPE>> read_from_file_cached
+	(
+		const std::string& path
+	) {
+		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+		// identified before parsing, so that a file modified in between never gets a cache marked as up to date
+		const cache::source_identity source = cache::identify(path);
+		if (auto cached = cache::open<DATA_TYPE>(source, path)) {
+			return cache::load<DATA_TYPE>(*cached);
+		}
+
+		auto document = read_from_file<DATA_TYPE, CUSTOM_PROTOTYPE>(path);
+		try {
+			cache::write(source, path, *document);
+		}
+		catch (const error::io_exception&) {
+			// the cache is an optimization, a read-only location should not make the read fail
+		}
+		return document;
+	}
+
+
+
+	// ---------------------------------
+	// [ SECTION ] Dictionary encoding
+	// ---------------------------------
+
+
+	// distinct values of a dictionary-encoded column, a value's code is its index in order of first appearance
+	template <typename CODE_TYPE = std::uint16_t>
+	class dictionary
+	{
+		static_assert(std::is_unsigned_v<CODE_TYPE>, "Dictionary codes should be unsigned integers.");
+	public:
+		static constexpr CODE_TYPE npos = std::numeric_limits<CODE_TYPE>::max();
+
+		dictionary() = default;
+		// moves keep the deque nodes, copies have to point their keys at their own values
+		dictionary(const dictionary& other) : m_values(other.m_values) { index(); }
+		dictionary(dictionary&&) = default;
+		dictionary& operator=(const dictionary& other)
+		{
+			if (this != &other) {
+				m_values = other.m_values;
+				index();
+			}
+			return *this;
+		}
+		dictionary& operator=(dictionary&&) = default;
+
+		// code of the value, added to the dictionary if it is not there yet
+		CODE_TYPE insert(std::string_view value)
+		{
+			auto it = m_codes.find(value);
+			if (it != m_codes.end()) {
+				return it->second;
+			}
+			if (m_values.size() >= npos) {
+				throw std::overflow_error("Too many distinct values for the dictionary code type.");
+			}
+			const CODE_TYPE code = static_cast<CODE_TYPE>(m_values.size());
+			m_values.emplace_back(value);
+			m_codes.emplace(m_values.back(), code); // deque elements never move, the key view stays valid
+			return code;
+		}
+
+		// code of the value, or npos if the value is not in the dictionary
+		CODE_TYPE find(std::string_view value) const {
+			auto it = m_codes.find(value);
+			return it == m_codes.end() ? npos : it->second;
+		}
+
+		const std::string& value(CODE_TYPE code) const { return m_values[code]; }
+		std::size_t size() const { return m_values.size(); }
+
+	private:
+		void index()
+		{
+			m_codes.clear();
+			m_codes.reserve(m_values.size());
+			for (std::size_t code = 0; code < m_values.size(); code++) {
+				m_codes.emplace(m_values[code], static_cast<CODE_TYPE>(code));
+			}
+		}
+
+		std::deque<std::string> m_values;
+		std::unordered_map<std::string_view, CODE_TYPE> m_codes;
+	};
+
+
+	// column storing one compact integer code per row instead of a string
+	template <typename CODE_TYPE = std::uint16_t>
+	struct dictionary_column
+	{
+		dictionary<CODE_TYPE> values;
+		std::vector<CODE_TYPE> codes;
+
+		std::size_t size() const { return codes.size(); }
+		const std::string& at(std::size_t row) const { return values.value(codes[row]); }
+
+		// indices of the rows equal to the value, compared on codes after a single dictionary lookup
+		std::vector<std::size_t> rows_equal(std::string_view value) const
+		{
+			std::vector<std::size_t> rows;
+			const CODE_TYPE code = values.find(value);
+			if (code == dictionary<CODE_TYPE>::npos) {
+				return rows;
+			}
+			for (std::size_t i = 0; i < codes.size(); i++) {
+				if (codes[i] == code) rows.push_back(i);
+			}
+			return rows;
+		}
+
+		// number of rows for each code
+		std::vector<std::size_t> counts() const
+		{
+			std::vector<std::size_t> counts(values.size(), 0);
+			for (const CODE_TYPE code : codes) {
+				counts[code]++;
+			}
+			return counts;
+		}
+
+		// row indices grouped by code
+		std::vector<std::vector<std::size_t>> group_by() const
+		{
+			std::vector<std::vector<std::size_t>> groups(values.size());
+			const std::vector<std::size_t> sizes = counts();
+			for (std::size_t code = 0; code < groups.size(); code++) {
+				groups[code].reserve(sizes[code]);
+			}
+			for (std::size_t i = 0; i < codes.size(); i++) {
+				groups[codes[i]].push_back(i);
+			}
+			return groups;
+		}
+	};
+
+
+	// the object returned when reading dictionary-encoded columns
+	template <typename CODE_TYPE = std::uint16_t>
+	struct dictionary_document
+	{
+		std::vector<std::string> header;
+		std::vector<dictionary_column<CODE_TYPE>> columns;
+
+		const dictionary_column<CODE_TYPE>& column(const std::string& name) const
+		{
+			for (std::size_t i = 0; i < header.size(); i++) {
+				if (header[i] == name) return columns[i];
+			}
+			throw std::out_of_range("Unknown column name.");
+		}
+	};
+
+
+	// encode the selected cells of the lines in [begin, end) into local dictionaries
+	template <typename CODE_TYPE>
+	static void encode_lines
+	(
+		const char* begin,
+		const char* end,
+		const std::vector<std::size_t>& indices,
+		const char delimiter,
+		std::vector<dictionary_column<CODE_TYPE>>& columns
+	) {
+		// position of each csv column in the selection, or npos when it is not selected
+		std::vector<std::size_t> selection;
+		for (std::size_t i = 0; i < indices.size(); i++) {
+			if (indices[i] >= selection.size()) selection.resize(indices[i] + 1, std::string::npos);
+			selection[indices[i]] = i;
+		}
+
+		if (indices.empty()) {
+			return;
+		}
+
+		std::string scratch; // quoted cells, unescaped
+		while (begin < end)
+		{
+			const char* line_end = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+			if (!line_end) line_end = end;
+			const std::size_t row = columns.front().codes.size();
+			const std::string_view line(begin, line_end - begin);
+
+			std::size_t position = 0;
+			for (std::size_t cell_index = 0; cell_index < selection.size() && position != std::string_view::npos; cell_index++)
+			{
+				const std::string_view cell = next_field(line, position, delimiter, scratch);
+				if (selection[cell_index] != std::string::npos) {
+					auto& column = columns[selection[cell_index]];
+					column.codes.push_back(column.values.insert(cell));
+				}
+			}
+
+			// short lines get empty values for their missing cells
+			for (auto& column : columns) {
+				if (column.codes.size() == row) {
+					column.codes.push_back(column.values.insert(std::string_view()));
+				}
+			}
+			begin = line_end + 1;
+		}
+	}
+
+
+	// read the selected columns (all of them by default) as dictionary-encoded columns.
+	// each worker encodes a range of lines into local dictionaries that are merged once the parse is over.
+	template <typename CODE_TYPE = std::uint16_t>
+	static std::unique_ptr<dictionary_document<CODE_TYPE>> read_dictionary_from_buffer
+	(
+		std::stringstream& buffer,
+		const std::vector<std::string>& columns = {},
+		const char delimiter = ','
+	) {
+		for (std::size_t i = 0; i < columns.size(); i++) {
+			if (std::find(columns.begin() + i + 1, columns.end(), columns[i]) != columns.end()) {
+				throw std::invalid_argument("Duplicate column name.");
+			}
+		}
+
+		auto document = std::make_unique<dictionary_document<CODE_TYPE>>();
+		std::vector<std::string> header;
+		read_header_from_buffer(buffer, header, delimiter);
+
+		std::vector<std::size_t> indices;
+		for (std::size_t i = 0; i < header.size(); i++) {
+			if (columns.empty() || std::find(columns.begin(), columns.end(), header[i]) != columns.end()) {
+				indices.push_back(i);
+				document->header.push_back(header[i]);
+			}
+		}
+		if (!columns.empty() && indices.size() != columns.size()) {
+			throw std::out_of_range("Unknown column name.");
+		}
+		document->columns.resize(indices.size());
+
+		const std::string content = buffer.str();
+		const std::streamoff position = buffer.tellg();
+		const char* begin = content.data() + (position < 0 ? content.size() : static_cast<std::size_t>(position));
+		const char* end = content.data() + content.size();
+		const std::size_t size = end - begin;
+
+#ifndef NO_ASYNC
+		const std::size_t workers_num = static_cast<std::size_t>(tune_read_options({}, size).threads);
+#else
+		const std::size_t workers_num = 1;
+#endif
+
+		// ranges start right after a line break so that each worker only sees complete lines
+		std::vector<const char*> bounds = { begin };
+		for (std::size_t w = 1; w < workers_num; w++) {
+			const char* split = std::max(begin + size * w / workers_num, bounds.back());
+			const char* newline = static_cast<const char*>(std::memchr(split, '\n', end - split));
+			bounds.push_back(newline ? newline + 1 : end);
+		}
+		bounds.push_back(end);
+
+		std::vector<std::vector<dictionary_column<CODE_TYPE>>> locals(workers_num, std::vector<dictionary_column<CODE_TYPE>>(indices.size()));
+		std::vector<std::exception_ptr> exceptions(workers_num);
+
+		auto for_each_worker = [&](auto&& task) {
+#ifndef NO_ASYNC
+			std::vector<std::thread> pool;
+			for (std::size_t w = 0; w < workers_num; w++) {
+				pool.emplace_back([&, w] {
+					try { task(w); }
+					catch (...) { exceptions[w] = std::current_exception(); }
+				});
+			}
+			for (auto& thread : pool) {
+				thread.join();
+			}
+			for (const auto& exception : exceptions) {
+				if (exception) std::rethrow_exception(exception);
+			}
+#else
+			task(0);
+#endif
+		};
 
-	// linearly serialize data to file using a prototype. The header can be omitted to only save rows to file.
-	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
-	static void write
-	(
-		const std::string filename,
-		const std::vector<DATA_TYPE>& rows,
-		const std::vector<std::string>& header = {}
-	) {
-		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
-			CUSTOM_PROTOTYPE proto;
-		std::stringstream buffer;
+		for_each_worker([&](std::size_t w) {
+			encode_lines(bounds[w], bounds[w + 1], indices, delimiter, locals[w]);
+		});
 
-		// write header to buffer
-		if (header.size()) {
-			const char delimiter = proto.get_delimiter();
-			for (const std::string& column_name : header) {
-				buffer << column_name << delimiter;
+		// merge the local dictionaries in worker order, so codes follow the order of first appearance in the file
+		std::vector<std::vector<std::vector<CODE_TYPE>>> translations(workers_num, std::vector<std::vector<CODE_TYPE>>(indices.size()));
+		std::vector<std::size_t> offsets(workers_num + 1, 0);
+		for (std::size_t c = 0; c < indices.size(); c++) {
+			auto& column = document->columns[c];
+			for (std::size_t w = 0; w < workers_num; w++) {
+				const auto& local = locals[w][c].values;
+				translations[w][c].reserve(local.size());
+				for (std::size_t code = 0; code < local.size(); code++) {
+					translations[w][c].push_back(column.values.insert(local.value(static_cast<CODE_TYPE>(code))));
+				}
 			}
-			buffer.seekp(-1, buffer.cur) << std::endl;
 		}
-
-		// write rows into buffer
-		for (const auto& row : rows) {
-			proto.serialize(buffer, row);
+		for (std::size_t w = 0; w < workers_num; w++) {
+			offsets[w + 1] = offsets[w] + (indices.empty() ? 0 : locals[w].front().codes.size());
+		}
+		for (auto& column : document->columns) {
+			column.codes.resize(offsets.back());
 		}
 
-		write_buffer_into_file(filename, buffer);
+		// translate local codes into global ones
+		for_each_worker([&](std::size_t w) {
+			for (std::size_t c = 0; c < indices.size(); c++) {
+				const auto& translation = translations[w][c];
+				CODE_TYPE* destination = document->columns[c].codes.data() + offsets[w];
+				for (const CODE_TYPE code : locals[w][c].codes) {
+					*destination++ = translation[code];
+				}
+			}
+		});
+		return document;
 	}
 
 
-#ifndef NO_ASYNC
+	template <typename CODE_TYPE = std::uint16_t>
+	static std::unique_ptr<dictionary_document<CODE_TYPE>> read_dictionary_from_file
+	(
+		const std::string& path,
+		const std::vector<std::string>& columns = {},
+		const char delimiter = ','
+	) {
+		std::stringstream buffer = get_buffer_from_file(path);
+		return read_dictionary_from_buffer<CODE_TYPE>(buffer, columns, delimiter);
+	}
 
-	static std::exception_ptr thread_exception = nullptr;
 
-	// check for exception during the parsing
-	static void CheckForThreadException() {
-		if (thread_exception) {
-			try {
-				std::rethrow_exception(thread_exception);
-			}
-			catch (const std::exception& ex)
-			{
-				std::stringstream msg;
-				msg << "An error occurred while parsing the csv file: ";
-				msg << ex.what();
-				throw std::exception(msg.str().c_str());
-			}
-		}
-	}
+
+	// ---------------------------
+	// [ SECTION ] Lazy reading
+	// ---------------------------
 
 
-	// asynchronous readers used to deserialize chunk of data
+	// document that only indexes the line offsets of its retained buffer when loaded, and deserializes
+	// a row through the prototype when it is accessed. Not thread-safe.
 	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
-	class async_reader
+	class lazy_document
 	{
-		using StoragePtr = std::shared_ptr< std::vector<DATA_TYPE>>;
 	public:
-		async_reader()
-			: m_prototype(CUSTOM_PROTOTYPE()), m_running(true)
+		// retain a buffer content, e.g. read from a socket
+		lazy_document(std::string content)
+			: m_content(std::move(content))
 		{
-			m_worker = std::thread([&]() { run(); });
+			CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+			index(m_content.data(), m_content.size());
 		}
 
-		~async_reader() {
-			shut_down();
-			m_worker.join();
+		// retain a memory-mapped file
+		lazy_document(std::unique_ptr<mapped_file> file)
+			: m_file(std::move(file))
+		{
+			CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
+			index(m_file->data(), m_file->size());
 		}
 
-		void enqueue(StoragePtr storage, std::stringstream buffer) {
-			m_queue.push({ storage, std::move(buffer) });
-			m_cv.notify_one();
+		lazy_document(const lazy_document&) = delete;
+		lazy_document& operator=(const lazy_document&) = delete;
+
+		std::size_t size() const { return m_lines.size() - 1; }
+
+		// raw content of a row, without its line break
+		std::string_view line(std::size_t row) const {
+			return std::string_view(m_data + m_lines[row], m_lines[row + 1] - m_lines[row] - 1);
 		}
 
-		void shut_down() {
-			m_running = false;
-			m_cv.notify_one();
+		// content of a cell, fields are split on access. unquoted cells are viewed in place, quoted ones
+		// are unescaped into a buffer that the next call overwrites
+		std::string_view cell(std::size_t row, std::size_t column) const
+		{
+			const std::string_view content = line(row);
+			std::size_t position = 0;
+			for (; column; column--) {
+				next_field(content, position, m_prototype.get_delimiter(), m_cell);
+				if (position == std::string_view::npos) {
+					throw std::out_of_range("Column index out of range.");
+				}
+			}
+			return next_field(content, position, m_prototype.get_delimiter(), m_cell);
+		}
+
+		// deserialize a row on each call
+		DATA_TYPE get(std::size_t row) const
+		{
+			if (row >= size()) {
+				throw std::out_of_range("Row index out of range.");
+			}
+			std::stringstream s{ std::string(line(row)) };
+			return m_prototype.deserialize(s);
+		}
+
+		// deserialize a row on its first access and keep the result for the next ones
+		const DATA_TYPE& at(std::size_t row)
+		{
+			auto it = m_rows.find(row);
+			if (it == m_rows.end()) {
+				it = m_rows.emplace(row, get(row)).first;
+			}
+			return it->second;
+		}
+
+		// deserialize every row, e.g. once the access pattern turns out not to be sparse
+		std::unique_ptr<Document<DATA_TYPE>> materialize()
+		{
+			auto document = std::make_unique<Document<DATA_TYPE>>();
+			document->header = header;
+			document->rows.reserve(size());
+			for (std::size_t row = 0; row < size(); row++) {
+				auto it = m_rows.find(row);
+				document->rows.push_back(it == m_rows.end() ? get(row) : it->second);
+			}
+			if (!m_arena->empty()) {
+				document->arenas.push_back(m_arena);
+			}
+			return document;
 		}
 
+		std::vector<std::string> header;
+
 	private:
-		// while the thread exists, either parse chunks of data or sleep
-		void run() {
-			while (true)
-			{
-				std::unique_lock<std::mutex> ul(m_lock);
-				m_cv.wait(ul, [&] {return !m_queue.empty() || !m_running; });
+		// structural pass: offsets of the line starts, followed by one past the end of the last line break
+		void index(const char* data, std::size_t size)
+		{
+			m_data = data;
+			m_prototype.bind_arena(m_arena.get());
 
-				try
-				{
-					while (!m_queue.empty())
-					{
-						auto row = m_queue.front().first;
-						std::string line;
-						while (std::getline(m_queue.front().second, line))
-						{
-							std::stringstream s(line);
-							row->push_back(m_prototype.deserialize(s));
-						}
-						m_queue.pop();
-					}
-					if (!m_running) break;
-				}
-				catch (...)
-				{
-					thread_exception = std::current_exception();
-				}
+			const char* end = data + size;
+			const char* newline = static_cast<const char*>(std::memchr(data, '\n', size));
+			std::stringstream header_line{ std::string(data, newline ? newline : end) };
+			read_header_from_buffer(header_line, header, m_prototype.get_delimiter());
+
+			m_lines.reserve(size / line_length_estimate + 1);
+			for (const char* cursor = newline ? newline + 1 : end; cursor < end; ) {
+				m_lines.push_back(cursor - data);
+				newline = static_cast<const char*>(std::memchr(cursor, '\n', end - cursor));
+				cursor = newline ? newline + 1 : end + 1;
 			}
+			m_lines.push_back(m_lines.empty() || end[-1] == '\n' ? size : size + 1);
 		}
 
+		static constexpr std::size_t line_length_estimate = 64;
+
 	private:
-		bool m_running;
+		std::string m_content;
+		std::unique_ptr<mapped_file> m_file;
+		const char* m_data = nullptr;
 
-		std::thread m_worker;
-		std::mutex m_lock;
-		std::condition_variable m_cv;
+		std::vector<std::size_t> m_lines;
+		std::unordered_map<std::size_t, DATA_TYPE> m_rows;
+		mutable std::string m_cell;
 
-		std::queue<std::pair<StoragePtr, std::stringstream>> m_queue;
 		CUSTOM_PROTOTYPE m_prototype;
+		std::shared_ptr<string_arena> m_arena = std::make_shared<string_arena>();
 	};
 
 
-	// read asynchronously from file using a prototype deserialize function and async_reader objects
+	// only index the rows of a memory-mapped file, rows are deserialized when accessed
 	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
-	static std::unique_ptr<Document<DATA_TYPE>> read_async_from_buffer
+	static std::unique_ptr<lazy_document<DATA_TYPE, CUSTOM_PROTOTYPE>> read_lazy_from_file
 	(
-		std::stringstream& buffer
-	)
+		const std::string& path
+	) {
+		return std::make_unique<lazy_document<DATA_TYPE, CUSTOM_PROTOTYPE>>(std::make_unique<mapped_file>(path));
+	}
+
+
+
+
+
+
+	// ------------------------------
+	// [ SECTION ] Synthetic data
+	// ------------------------------
+
+
+	// seeded generation of csv files for benchmarks and load tests. Rows are generated by blocks on several threads,
+	// each block having its own random stream so that the output only depends on the seed.
+	namespace generator
 	{
-		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
-			CUSTOM_PROTOTYPE proto;
-		thread_exception = nullptr;
+		enum class Kind {
+			INT,
+			FLOAT,  // two decimals
+			STRING,
+		};
 
-		auto document = std::make_unique<Document<DATA_TYPE>>();
-		read_header_from_buffer(buffer, document->header, proto.get_delimiter());
+		struct column {
+			std::string name;
+			Kind kind = Kind::STRING;
+			// lengths of strings, uniform between both bounds
+			std::size_t min_length = 4;
+			std::size_t max_length = 16;
+			// values of numbers, uniform between both bounds
+			std::int64_t min_value = 0;
+			std::int64_t max_value = 1000000;
+			// frequency of empty cells
+			double null_rate = 0;
+			// frequency of strings containing the delimiter and a quote, so written quoted
+			double quote_rate = 0;
+			// frequency of strings containing a line break. Readers splitting lines in parallel do not support them
+			double newline_rate = 0;
+		};
 
-		// store data process by threads to retrieve it in the right order
-		// use of smart pointers to avoid storage reallocation problems
-		std::vector<std::shared_ptr<std::vector<DATA_TYPE>>> storages;
-		storages.reserve(1 << 10); // arbitrary default starting capacity
+		struct schema {
+			std::vector<column> columns;
+			char delimiter = ',';
+		};
 
-		{ // Processing scope for threads
-			std::vector<std::unique_ptr<async_reader<DATA_TYPE, CUSTOM_PROTOTYPE>>> pool = {};
-			pool.reserve(thread_num);
+		struct options {
+			std::uint64_t seed = 42;
+			std::uint64_t rows = 1 << 20;
+			// when set, rows are generated until the output reaches this size instead
+			std::uint64_t bytes = 0;
+			std::size_t block_rows = 1 << 12;
+		};
 
-			for (int i = 0; i < thread_num; i++) {
-				pool.push_back(std::make_unique<async_reader<DATA_TYPE, CUSTOM_PROTOTYPE>>());
-			}
+		// rows read by person_prototype
+		inline schema person_schema()
+		{
+			schema s;
+			s.columns.push_back({ "Names", Kind::STRING, 3, 12 });
+			column age = { "Age", Kind::INT };
+			age.max_value = 99;
+			s.columns.push_back(age);
+			return s;
+		}
 
-			char* subBuffer = new char[line_length_hint * line_chunk_size];
-			unsigned char reader_index = 0;
+		// rows read by experimental::single_type_prototype
+		inline schema single_type_schema(Kind kind, std::size_t columns)
+		{
+			schema s;
+			for (std::size_t c = 0; c < columns; c++) {
+				column current;
+				current.name = "c" + std::to_string(c);
+				current.kind = kind;
+				s.columns.push_back(current);
+			}
+			return s;
+		}
 
-			while (buffer.rdbuf()->in_avail())
-			{
-				std::streamsize extractNum = buffer.readsome(subBuffer, line_length_hint * line_chunk_size);
-				std::stringstream subBufferStream;
-				subBufferStream.write(subBuffer, static_cast<int>(extractNum));
-
-				// subBuffer has a fix size so the last line is almost surely cut before its end
-				// we linearly push into our subBufferString until the last line is complete
-				char c = buffer.get();
-				while (c != '\n' && buffer.rdbuf()->in_avail())
-				{
-					subBufferStream << c;
-					c = buffer.get();
+		// throw for columns whose bounds are reversed, or whose values in hundredths would overflow for floats,
+		// before any row is generated
+		inline void validate(const schema& schema)
+		{
+			constexpr std::int64_t float_limit = std::numeric_limits<std::int64_t>::max() / 200;
+			for (const column& column : schema.columns) {
+				if (column.kind == Kind::STRING && column.max_length < column.min_length) {
+					throw std::invalid_argument("Column '" + column.name + "' has a max_length lower than its min_length.");
+				}
+				if (column.kind != Kind::STRING && column.max_value < column.min_value) {
+					throw std::invalid_argument("Column '" + column.name + "' has a max_value lower than its min_value.");
+				}
+				if (column.kind == Kind::FLOAT && (column.min_value < -float_limit || column.max_value > float_limit)) {
+					throw std::invalid_argument("Column '" + column.name + "' has float bounds out of range.");
 				}
+			}
+		}
 
-				// We prepare a storage to store the thread's result
-				storages.push_back(std::make_shared<std::vector<DATA_TYPE>>());
-				storages.back()->reserve(1 << 8); //arbitrary default starting capacity
+		// splitmix64, small and fast enough not to be the bottleneck
+		class random_stream
+		{
+		public:
+			explicit random_stream(std::uint64_t seed) : m_state(seed) {}
 
-				// enqueue the subBufferString to the thread queue
-				pool[reader_index]->enqueue(storages.back(), std::move(subBufferStream));
-				reader_index = reader_index < pool.size() - 1 ? reader_index + 1 : 0;
+			std::uint64_t next() {
+				std::uint64_t z = (m_state += 0x9e3779b97f4a7c15ull);
+				z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+				z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+				return z ^ (z >> 31);
 			}
-			delete[] subBuffer;
-		} // calls reader's destructor that wait for their worker to finish processing and to join.
 
-		CheckForThreadException();
+			// uniform between 0 included and bound excluded, multiplying instead of dividing for small bounds
+			std::uint64_t below(std::uint64_t bound) {
+				if (bound <= std::numeric_limits<std::uint32_t>::max()) {
+					return ((next() >> 32) * bound) >> 32;
+				}
+				return next() % bound;
+			}
 
+			bool chance(double probability) { return probability > 0 && static_cast<double>(next() >> 11) * 0x1.0p-53 < probability; }
 
-		// transferring processed data to the content
-		for (const auto& rows : storages) {
-			document->rows.insert(document->rows.end(), rows->begin(), rows->end());
+		private:
+			std::uint64_t m_state;
+		};
+
+		// rows are formatted in place in the buffer, up to this size
+		inline std::size_t max_row_size(const schema& schema)
+		{
+			std::size_t size = schema.columns.size() + 1;
+			for (const column& column : schema.columns) {
+				size += column.kind == Kind::STRING ? 2 * column.max_length + 2 : 24;
+			}
+			return size;
 		}
-		return document;
-	}
-#endif
 
+		inline char* write_string(random_stream& random, const column& column, const char delimiter, char* output)
+		{
+			static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .";
+			const std::size_t length = column.min_length + random.below(column.max_length - column.min_length + 1);
+			for (std::size_t i = 0; i < length; i += 8) {
+				std::uint64_t bits = random.next();
+				for (std::size_t j = i; j < std::min(length, i + 8); j++, bits >>= 8) {
+					output[j] = alphabet[bits & 63];
+				}
+			}
 
+			bool special = std::memchr(alphabet, delimiter, sizeof(alphabet) - 1) != nullptr;
+			if (length && random.chance(column.quote_rate)) {
+				output[random.below(length)] = delimiter;
+				output[random.below(length)] = '"';
+				special = true;
+			}
+			if (length && random.chance(column.newline_rate)) {
+				output[random.below(length)] = '\n';
+				special = true;
+			}
+			if (!special || !needs_quoting(std::string_view(output, length), delimiter)) {
+				return output + length;
+			}
 
-	// read from file with a default asynchronous behavior
-#ifndef NO_ASYNC
+			// quoted field, quotes being doubled
+			const std::string field(output, length);
+			*output++ = '"';
+			for (const char c : field) {
+				if (c == '"') *output++ = '"';
+				*output++ = c;
+			}
+			*output++ = '"';
+			return output;
+		}
 
-	enum class Method {
-		DEFAULT,
-		ASYNC,
-	};
+		inline char* write_float(random_stream& random, const column& column, char* output)
+		{
+			const std::int64_t range = (column.max_value - column.min_value) * 100 + 1;
+			std::int64_t hundredths = column.min_value * 100 + static_cast<std::int64_t>(random.below(static_cast<std::uint64_t>(range)));
+			if (hundredths < 0) {
+				*output++ = '-';
+				hundredths = -hundredths;
+			}
+			output = std::to_chars(output, output + 20, hundredths / 100).ptr;
+			*output++ = '.';
+			*output++ = static_cast<char>('0' + hundredths / 10 % 10);
+			*output++ = static_cast<char>('0' + hundredths % 10);
+			return output;
+		}
 
-	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
-	static std::unique_ptr<Document<DATA_TYPE>> read_from_file
-	(
-		const std::string& path,
-		Method method = Method::ASYNC
-	) {
-		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
-			std::stringstream buffer = get_buffer_from_file(path);
+		// rows of a block, row_ends receiving the end offset of each of them
+		inline void generate_block
+		(
+			const schema& schema,
+			const options& options,
+			std::uint64_t block,
+			std::size_t rows,
+			output_buffer& buffer,
+			std::vector<std::size_t>& row_ends
+		) {
+			random_stream random(random_stream(options.seed ^ (block * 0xd1b54a32d192ed03ull)).next());
+			const std::size_t row_size = max_row_size(schema);
+			for (std::size_t row = 0; row < rows; row++) {
+				const std::size_t start = buffer.size();
+				char* const begin = buffer.grow(row_size);
+				char* output = begin;
+				for (std::size_t c = 0; c < schema.columns.size(); c++) {
+					const column& column = schema.columns[c];
+					if (c) {
+						*output++ = schema.delimiter;
+					}
+					if (random.chance(column.null_rate)) {
+						continue;
+					}
+					switch (column.kind)
+					{
+					case Kind::INT:
+						// the range is counted unsigned so that wide ones do not overflow
+						output = std::to_chars(output, output + 24, static_cast<std::int64_t>(static_cast<std::uint64_t>(column.min_value)
+							+ random.below(static_cast<std::uint64_t>(column.max_value) - static_cast<std::uint64_t>(column.min_value) + 1))).ptr;
+						break;
+					case Kind::FLOAT:
+						output = write_float(random, column, output);
+						break;
+					case Kind::STRING:
+						output = write_string(random, column, schema.delimiter, output);
+						break;
+					}
+				}
+				*output++ = '\n';
+				buffer.resize(start + static_cast<std::size_t>(output - begin));
+				row_ends.push_back(buffer.size());
+			}
+		}
 
-		switch (method)
+		// write a generated csv file with its header, returns the number of rows
+		inline std::uint64_t write_file(const std::string& path, const schema& schema, const options& options = {})
 		{
-		case csv::Method::DEFAULT:
-			return read_from_buffer<DATA_TYPE, CUSTOM_PROTOTYPE>(buffer);
-		case csv::Method::ASYNC:
-			return read_async_from_buffer<DATA_TYPE, CUSTOM_PROTOTYPE>(buffer);
-		default:
-			throw error::not_implemented("Reading method not implemented.");
-		}
-	}
-#else
-	template <typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
-	static std::unique_ptr<Document<DATA_TYPE>> read_from_file
-	(
-		const std::string& path
-	) {
-		CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
-			std::stringstream buffer = get_buffer_from_file(path);
-		return read_from_buffer<DATA_TYPE, CUSTOM_PROTOTYPE>(buffer);
-	}
-#endif
+			validate(schema);
+			output_file file(path);
+			output_buffer header(schema.delimiter);
+			for (std::size_t c = 0; c < schema.columns.size(); c++) {
+				if (c) header.append_delimiter();
+				header.append_field(schema.columns[c].name);
+			}
+			header.end_row();
+			file.write(header.data(), header.size());
+
+			const std::size_t block_rows = std::max<std::size_t>(options.block_rows, 1);
+			const std::uint64_t blocks_num = options.bytes ? std::numeric_limits<std::uint64_t>::max() : (options.rows + block_rows - 1) / block_rows;
 
+			// blocks are generated in parallel and written in order
+			std::atomic<std::uint64_t> next_block = 0;
+			std::mutex placement_lock;
+			std::condition_variable placement_cv;
+			std::uint64_t placed_blocks = 0;
+			std::uint64_t written = header.size();
+			std::uint64_t rows = 0;
+			bool done = false;
+			std::exception_ptr exception;
+
+			const auto work = [&] {
+				output_buffer buffer(schema.delimiter, 1 << 20);
+				std::vector<std::size_t> row_ends;
+				try {
+					for (std::uint64_t block = next_block++; block < blocks_num; block = next_block++)
+					{
+						const std::size_t block_size = options.bytes ? block_rows
+							: static_cast<std::size_t>(std::min<std::uint64_t>(block_rows, options.rows - block * block_rows));
+						buffer.clear();
+						row_ends.clear();
+						generate_block(schema, options, block, block_size, buffer, row_ends);
 
+						std::unique_lock<std::mutex> ul(placement_lock);
+						placement_cv.wait(ul, [&] { return placed_blocks == block || done; });
+						if (done) {
+							return;
+						}
+						std::size_t size = buffer.size();
+						std::size_t rows_num = row_ends.size();
+						if (options.bytes && written + size >= options.bytes) {
+							// the last block is cut after the first row reaching the requested size
+							const std::size_t missing = static_cast<std::size_t>(options.bytes > written ? options.bytes - written : 0);
+							rows_num = static_cast<std::size_t>(std::lower_bound(row_ends.begin(), row_ends.end(), missing) - row_ends.begin()) + 1;
+							size = row_ends[rows_num - 1];
+							done = true;
+						}
+						file.write(buffer.data(), size);
+						written += size;
+						rows += rows_num;
+						placed_blocks++;
+						done = done || placed_blocks == blocks_num;
+						ul.unlock();
+						placement_cv.notify_all();
+					}
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lg(placement_lock);
+					exception = std::current_exception();
+					done = true;
+					placement_cv.notify_all();
+				}
+			};
 
+#ifndef NO_ASYNC
+			std::vector<std::thread> pool;
+			for (int i = 0; i < thread_num; i++) {
+				pool.push_back(std::thread(work));
+			}
+			for (auto& thread : pool) {
+				thread.join();
+			}
+#else
+			work();
+#endif
+			if (exception) {
+				std::rethrow_exception(exception);
+			}
+			file.close();
+			return rows;
+		}
+	}
 
 
 
@@ -407,6 +5166,7 @@ namespace csv
 			static constexpr bool is_int = std::is_same_v<DATA_TYPE, int>;
 			static constexpr bool is_float = std::is_same_v<DATA_TYPE, float>;
 			static constexpr bool is_string = std::is_same_v<DATA_TYPE, std::string>;
+			static constexpr bool is_string_view = std::is_same_v<DATA_TYPE, std::string_view>;
 
 		public:
 			// input row data to a string stream passed by ref
@@ -416,19 +5176,48 @@ namespace csv
 					throw std::underflow_error("Csv row does not have data to serialize.");
 				}
 
+				const char delimiter = prototype<std::vector<DATA_TYPE>>::get_delimiter();
 				for (auto it = data.begin(); it != data.end(); ++it) {
-					buffer << *it << prototype<std::vector<DATA_TYPE>>::get_delimiter();
+					if constexpr (is_string || is_string_view) {
+						write_field(buffer, *it, delimiter);
+						buffer << delimiter;
+					}
+					else {
+						buffer << *it << delimiter;
+					}
 				}
 				buffer.seekp(-1, buffer.cur) << std::endl;
 			}
 
+			// append row data to the writers byte buffer, without going through iostreams
+			virtual void serialize(output_buffer& buffer, const std::vector<DATA_TYPE>& data) const override
+			{
+				if (!data.size()) {
+					throw std::underflow_error("Csv row does not have data to serialize.");
+				}
+
+				for (auto it = data.begin(); it != data.end(); ++it) {
+					if (it != data.begin()) {
+						buffer.append_delimiter();
+					}
+					if constexpr (is_string || is_string_view) {
+						buffer.append_field(*it);
+					}
+					else {
+						buffer.append_number(*it);
+					}
+				}
+				buffer.end_row();
+			}
+
 			// convert buffer to T data
 			virtual std::vector<DATA_TYPE> deserialize(std::stringstream& buffer) const override
 			{
-				std::string cell;
+				// reused from row to row, cells are only copied out of it
+				thread_local std::string cell;
 				std::vector<DATA_TYPE> data;
 
-				while (std::getline(buffer, cell, prototype<std::vector<DATA_TYPE>>::get_delimiter()))
+				while (read_field(buffer, cell, prototype<std::vector<DATA_TYPE>>::get_delimiter()))
 				{
 					// Compile-time conditions to parse data
 					if constexpr (is_float) {
@@ -440,6 +5229,9 @@ namespace csv
 					else if constexpr (is_string) {
 						data.emplace_back(cell);
 					}
+					else if constexpr (is_string_view) {
+						data.emplace_back(prototype<std::vector<DATA_TYPE>>::store(cell));
+					}
 					else {
 						throw error::not_implemented("Type conversion not implemented.");
 					}
@@ -450,54 +5242,108 @@ namespace csv
 
 
 #ifndef NO_ASYNC
-		// not dramatically faster than write except if the prototype deserialize method is time consuming
+		// serialize blocks of rows on a pool of threads. Each block is written at an offset given by the running
+		// sum of the sizes of the blocks before it, as soon as these are known, so threads only hold one block
+		// at a time and output is byte-identical to write. Worth it when the prototype serialize method is slow.
 		template<typename DATA_TYPE, typename CUSTOM_PROTOTYPE>
 		static void write_async(
 			const std::string& filename,
 			const std::vector<DATA_TYPE>& rows,
-			const std::vector<std::string>& header = {}
+			const std::vector<std::string>& header = {},
+			const write_options& options = {}
 		) {
 			CUSTOM_PROTOTYPE_ASSERT(DATA_TYPE, CUSTOM_PROTOTYPE)
 				CUSTOM_PROTOTYPE proto;
 			thread_exception = nullptr;
 
-			const unsigned int rows_num = rows.size();
+			const std::size_t rows_num = rows.size();
+			const std::size_t blocks_num = (rows_num + write_block_size - 1) / write_block_size;
 
-			if (rows_num < thread_num) {
-				write<DATA_TYPE, CUSTOM_PROTOTYPE>(filename, rows, header);
+			// positional writes cannot be used on files opened in append mode
+			if (blocks_num < 2 || options.append) {
+				write<DATA_TYPE, CUSTOM_PROTOTYPE>(filename, rows, header, options);
 				return;
 			}
 
-			const unsigned int chunk_size = rows_num / thread_num;
-			const unsigned int remaining_size = rows_num - chunk_size * thread_num - 1;
+			output_file file(filename, options);
+			output_buffer header_line(proto.get_delimiter());
+			write_header_into_buffer(header_line, header);
+			std::string header_bytes(header_line.view());
+			if (const auto header_encoder = make_encoder(options.compression, options.compression_level)) {
+				header_bytes.clear();
+				header_encoder->encode(header_line.data(), header_line.size(), header_bytes);
+			}
+			file.write_encoded(header_bytes.data(), header_bytes.size());
 
-			std::vector<std::thread> pool;
-			pool.reserve(thread_num);
+			std::atomic<std::size_t> next_block = 0;
 
-			std::vector<std::shared_ptr<std::stringstream>> streams;
-			streams.reserve(thread_num);
+			// placement state: blocks get their offset in order
+			std::mutex placement_lock;
+			std::condition_variable placement_cv;
+			std::size_t placed_blocks = 0;
+			std::uint64_t offset = header_bytes.size();
+			bool failed = false;
 
+			const int workers_num = options.threads > 0 ? options.threads : thread_num;
+			std::vector<std::thread> pool;
+			pool.reserve(workers_num);
 
-			for (int i = 0; i < thread_num; i++)
+			for (int i = 0; i < workers_num; i++)
 			{
-				auto buffer = std::make_shared<std::stringstream>();
-				streams.push_back(buffer);
-
 				pool.push_back(std::thread(
-					[=] {
-						unsigned int cur = chunk_size * i;
-						unsigned int end = i < thread_num - 1 ? cur + chunk_size : cur + chunk_size + remaining_size;
-
-						while (cur <= end) {
-							try {
-								proto.serialize(*buffer, rows[cur]);
-								cur++;
-							}
-							catch (...)
+					[&] {
+						const CUSTOM_PROTOTYPE worker_proto;
+						const prototype<DATA_TYPE>& serializer = worker_proto;
+						output_buffer bytes(worker_proto.get_delimiter());
+						std::string encoded;
+						try {
+							// blocks are compressed by the workers into independent members or frames
+							const auto worker_encoder = make_encoder(options.compression, options.compression_level);
+							for (std::size_t block = next_block++; block < blocks_num; block = next_block++)
 							{
-								thread_exception = std::current_exception();
+								bytes.clear();
+								const std::size_t end = std::min(rows_num, (block + 1) * write_block_size);
+								for (std::size_t cur = block * write_block_size; cur < end; cur++) {
+									serializer.serialize(bytes, rows[cur]);
+								}
+								std::string_view output = bytes.view();
+								if (worker_encoder) {
+									encoded.clear();
+									worker_encoder->encode(bytes.data(), bytes.size(), encoded);
+									output = encoded;
+								}
+
+								std::unique_lock<std::mutex> ul(placement_lock);
+								placement_cv.wait(ul, [&] { return placed_blocks == block || failed; });
+								if (failed) {
+									return;
+								}
+#ifdef CSV_POSIX
+								if (!file.direct()) {
+									const std::uint64_t position = offset;
+									offset += output.size();
+									placed_blocks++;
+									ul.unlock();
+									placement_cv.notify_all();
+									file.write_at(output.data(), output.size(), position);
+									continue;
+								}
+#endif
+								// sequential writes: direct writes are aligned blocks that overlap with the formatting anyway
+								file.write_encoded(output.data(), output.size());
+								offset += output.size();
+								placed_blocks++;
+								ul.unlock();
+								placement_cv.notify_all();
 							}
 						}
+						catch (...)
+						{
+							std::lock_guard<std::mutex> lg(placement_lock);
+							thread_exception = std::current_exception();
+							failed = true;
+							placement_cv.notify_all();
+						}
 					}
 				));
 			}
@@ -507,18 +5353,7 @@ namespace csv
 			}
 
 			CheckForThreadException();
-
-			std::ofstream file(filename);
-
-			// write header
-			for (const std::string& title : header) {
-				file << title << proto.get_delimiter();
-			}
-			file.seekp(-1, file.cur) << std::endl;
-
-			for (auto it = streams.begin(); it != streams.end(); it++) {
-				file << it->get()->rdbuf();
-			}
+			file.close();
 		}
 #endif
 	}
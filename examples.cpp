@@ -1,3 +1,4 @@
+#include <iostream>
 #include <vector>
 #include "prototypes.hpp"
 
@@ -49,7 +50,7 @@ int main()
 		std::cerr << e.what() << std::endl;
 	}
 
-	// reading single type data from a csv file, currently only supporting [int, float, strings]
+	// reading single type data from a csv file, currently only supporting [int, float, strings, string views]
 	try {
 		auto document = csv::read_from_file
 			<
@@ -62,5 +63,29 @@ int main()
 		std::cerr << e.what() << std::endl;
 	}
 
+	// following a growing csv file, a row that cannot be deserialized makes the poll throw and is skipped
+	try {
+		std::ofstream("log.csv") << "value\n1\nbad\n2\n3\n";
+		csv::Document<std::vector<int>> document;
+		csv::tail_reader<std::vector<int>, csv::experimental::single_type_prototype<int>> tail("log.csv");
+		try {
+			tail.poll(document);
+		}
+		catch (const std::invalid_argument&) {
+			// "bad" is lost, the next poll resumes after it
+		}
+		tail.poll(document);
+		std::ofstream("log.csv", std::ios::app) << "4\n";
+		tail.poll(document);
+		if (document.rows.size() != 4 || document.rows.back().front() != 4) {
+			std::cerr << "rows were lost after the bad one" << std::endl;
+			return 1;
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
 	return 0;
 }
\ No newline at end of file
@@ -15,15 +15,25 @@ public:
 	// to implement for saving data into a csv file
 	virtual void serialize(std::stringstream& buffer, const person& data) const override
 	{
-		buffer << data.name << prototype::get_delimiter();
+		csv::write_field(buffer, data.name, prototype::get_delimiter());
+		buffer << prototype::get_delimiter();
 		buffer << data.age << std::endl;
 	}
 
+	// optional, faster than the stringstream version as it skips iostreams
+	virtual void serialize(csv::output_buffer& buffer, const person& data) const override
+	{
+		buffer.append_field(data.name);
+		buffer.append_delimiter();
+		buffer.append_number(data.age);
+		buffer.end_row();
+	}
+
 	// to implement for loading data from a csv file
 	virtual person deserialize(std::stringstream& buffer) const override
 	{
 		person p;
-		std::getline(buffer, p.name, prototype::get_delimiter());
+		csv::read_field(buffer, p.name, prototype::get_delimiter());
 		buffer >> p.age;
 		return p;
 	}